@@ -0,0 +1,283 @@
+#pragma once
+#include <JuceHeader.h>
+#include "WaveshaperProcessor.h"
+#include "ToneStack.h"
+#include "IRProcessor.h"
+#include "GainRamp.h"
+#include "SignalGraph.h"
+#include "LevelMeter.h"
+#include "StageProfiler.h"
+
+// The amp signal chain without any UI attached, so the live callback and the
+// command line tools all run exactly the same processing.
+class AmpEngine
+{
+public:
+    AmpEngine()
+    {
+        irProcessor.setProfiler(&profiler);
+    }
+
+    // The amp input is a single channel, so by default only the left channel is
+    // carried through gain, waveshapers, EQ and cabinet, and the IR stage fans it
+    // out to stereo at the reverb. Turning this off runs every stage on both
+    // channels. Call before prepare.
+    void setMonoProcessing(bool shouldProcessMono)
+    {
+        monoProcessing = shouldProcessMono;
+    }
+
+    bool isMonoProcessing() const { return monoProcessing; }
+
+    // The stages are prepared for one power of two block size and never see
+    // more than that: process() cuts each callback into sub-blocks of at most
+    // this many samples, so a device that delivers more than it promised, or a
+    // different size every time, still runs within what was allocated. 0 picks
+    // the power of two at or above the spec's maximumBlockSize. Call before prepare.
+    void setInternalBlockSize(int numSamples)
+    {
+        requestedInternalBlockSize = numSamples;
+    }
+
+    // As of the last prepare()
+    int getInternalBlockSize() const { return internalBlockSize; }
+
+    void prepare(const juce::dsp::ProcessSpec& spec)
+    {
+        const int requested = requestedInternalBlockSize > 0 ? requestedInternalBlockSize : (int)spec.maximumBlockSize;
+        internalBlockSize = juce::jlimit(minInternalBlockSize, maxInternalBlockSize, (int)juce::nextPowerOfTwo(requested));
+        const juce::dsp::ProcessSpec stageSpec{ spec.sampleRate, (juce::uint32)internalBlockSize, spec.numChannels };
+
+        // The EQ gets every channel, since a graph can place it after the IR
+        const juce::dsp::ProcessSpec frontSpec{ spec.sampleRate, stageSpec.maximumBlockSize, monoProcessing ? 1u : spec.numChannels };
+        waveshaper.prepare(frontSpec);
+        eq.prepare(stageSpec);
+        irProcessor.prepare(stageSpec);
+        graph.prepare(stageSpec, monoProcessing);
+        profiler.prepare(spec.sampleRate);
+        irProcessor.setUpstreamLatency(waveshaper.getLatencyInSamples());
+
+        inputGainRamp.reset(spec.sampleRate, gainRampSeconds);
+        outputGainRamp.reset(spec.sampleRate, gainRampSeconds);
+        jumpToGainTargets = true;
+    }
+
+    // Runs the stages in the order the signal graph gives, by default
+    // input gain -> pre EQ waveshaper -> EQ -> post EQ waveshaper -> IRs -> output gain.
+    // Blocks of any length are fine; see setInternalBlockSize().
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        // Settings made between prepare and the first block shouldn't ramp in from the defaults
+        if (jumpToGainTargets) {
+            inputGainRamp.setCurrentAndTarget(gain.load());
+            outputGainRamp.setCurrentAndTarget(outputGain.load());
+            jumpToGainTargets = false;
+        }
+
+        // Every stage copes with a short block, so the remainder runs as it is
+        // rather than waiting in a FIFO for the rest of a quantum
+        auto& plan = graph.getPlan();
+        const size_t numSamples = block.getNumSamples();
+        for (size_t start = 0; start < numSamples; start += (size_t)internalBlockSize) {
+            auto subBlock = block.getSubBlock(start, juce::jmin((size_t)internalBlockSize, numSamples - start));
+            if (plan.isDefaultChain)
+                processDefaultChain(subBlock);
+            else
+                processPlan(plan, subBlock);
+        }
+    }
+
+    // Control thread. Takes over at the start of a block once compiled; returns
+    // false and keeps the current graph if the text doesn't parse.
+    bool setSignalGraph(const juce::String& text, juce::String& error)
+    {
+        SignalGraph::Description description;
+        if (!SignalGraph::Description::parse(text, description, error))
+            return false;
+
+        graph.setDescription(description);
+        return true;
+    }
+
+    juce::String getSignalGraph() const { return graph.getText(); }
+
+    // For offline renders: makes the last setSignalGraph() take effect before the first block
+    bool waitForSignalGraph(int timeoutMs) { return graph.finishPendingChange(timeoutMs); }
+
+    // Hard limit right before the samples leave the engine, feeding the output
+    // meter from the same pass so it sees the overs
+    void clampOutput(juce::dsp::AudioBlock<float>& block)
+    {
+        LevelStats levels;
+        LevelAccumulator accumulator(levels);
+        const size_t numSamples = block.getNumSamples();
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
+            auto* channelData = block.getChannelPointer(channel);
+            size_t sample = 0;
+           #if AMP_SIMD_FLOAT4
+            const auto lower = Float4::broadcast(-1.0f);
+            const auto upper = Float4::broadcast(1.0f);
+            for (; sample + 4 <= numSamples; sample += 4) {
+                const auto samples = Float4::load(channelData + sample);
+                accumulator.add(samples);
+                Float4::store(channelData + sample, Float4::min(Float4::max(samples, lower), upper));
+            }
+           #endif
+            for (; sample < numSamples; ++sample) {
+                accumulator.add(channelData[sample]);
+                channelData[sample] = juce::jlimit(-1.0f, 1.0f, channelData[sample]);
+            }
+            accumulator.finish(numSamples);
+        }
+
+        outputMeter.publish(levels);
+    }
+
+    void setInputGain(float newGain) { gain = newGain; }
+    void setOutputGain(float newGain) { outputGain = newGain; }
+
+    void setOversamplingFactor(int factor)
+    {
+        waveshaper.setOversamplingFactor(factor);
+        irProcessor.setUpstreamLatency(waveshaper.getLatencyInSamples());
+    }
+
+    void setAntiderivativeOrder(int order)
+    {
+        waveshaper.setAntiderivativeOrder(order);
+        irProcessor.setUpstreamLatency(waveshaper.getLatencyInSamples());
+    }
+
+    int getLatencyInSamples() const { return irProcessor.getLatencyInSamples(); }
+
+    WaveshaperProcessor& getWaveshaper() { return waveshaper; }
+    ToneStack& getToneStack() { return eq; }
+    IRProcessor& getIRProcessor() { return irProcessor; }
+
+    // Levels entering the input gain stage and leaving clampOutput(), for one reader each
+    LevelMeter& getInputMeter() { return inputMeter; }
+    LevelMeter& getOutputMeter() { return outputMeter; }
+
+    // Times every stage; the callback opens a StageProfiler::CallbackScope around process()
+    StageProfiler& getProfiler() { return profiler; }
+
+private:
+    static constexpr double gainRampSeconds = 0.02;
+    static constexpr int minInternalBlockSize = 32;
+    static constexpr int maxInternalBlockSize = 1024;
+
+    // The default order with every call spelled out, so the common case pays nothing for the graph
+    void processDefaultChain(juce::dsp::AudioBlock<float>& block)
+    {
+        auto front = monoProcessing ? block.getSingleChannelBlock(0) : block;
+
+        processStage<SignalGraph::Stage::inputGain>(front);
+        processStage<SignalGraph::Stage::preShaper>(front);
+        processStage<SignalGraph::Stage::eq>(front);
+        processStage<SignalGraph::Stage::postShaper>(front);
+        processStage<SignalGraph::Stage::ir>(block);
+        processStage<SignalGraph::Stage::outputGain>(block);
+    }
+
+    void processPlan(SignalGraph::Plan& plan, juce::dsp::AudioBlock<float>& block)
+    {
+        for (const auto& step : plan.steps)
+        {
+            auto target = plan.getBlock(step.target, block, step.wide);
+            switch (step.op)
+            {
+                case SignalGraph::Step::copy:
+                    target.copyFrom(plan.getBlock(step.source, block, step.wide));
+                    break;
+                case SignalGraph::Step::add:
+                    target.add(plan.getBlock(step.source, block, step.wide));
+                    break;
+                case SignalGraph::Step::process:
+                    processStage(step.stage, target);
+                    break;
+                case SignalGraph::Step::fanOut:
+                    juce::FloatVectorOperations::copy(target.getChannelPointer(1), target.getChannelPointer(0), (int)target.getNumSamples());
+                    break;
+            }
+        }
+    }
+
+    // A single stage on a block; the IR stage is handed both channels and fans a mono front out itself
+    template <SignalGraph::Stage stage>
+    void processStage(juce::dsp::AudioBlock<float>& block)
+    {
+        const StageProfiler::StageScope profile(profiler, (int)stage);
+
+        if constexpr (stage == SignalGraph::Stage::inputGain) {
+            inputGainRamp.setTarget(gain.load(std::memory_order_relaxed));
+            LevelStats levels;
+            applyGain(inputGainRamp, block, &levels);
+            inputMeter.publish(levels);
+        }
+        else if constexpr (stage == SignalGraph::Stage::preShaper) {
+            waveshaper.processPreEQ(block);
+        }
+        else if constexpr (stage == SignalGraph::Stage::eq) {
+            eq.process(block);
+        }
+        else if constexpr (stage == SignalGraph::Stage::postShaper) {
+            waveshaper.processPostEQ(block);
+        }
+        else if constexpr (stage == SignalGraph::Stage::ir) {
+            if (monoProcessing)
+                irProcessor.processFromMono(block);
+            else
+                irProcessor.process(block);
+        }
+        else if constexpr (stage == SignalGraph::Stage::outputGain) {
+            outputGainRamp.setTarget(outputGain.load(std::memory_order_relaxed));
+            applyGain(outputGainRamp, block);
+        }
+    }
+
+    void processStage(SignalGraph::Stage stage, juce::dsp::AudioBlock<float>& block)
+    {
+        switch (stage)
+        {
+            case SignalGraph::Stage::inputGain:  processStage<SignalGraph::Stage::inputGain>(block); break;
+            case SignalGraph::Stage::preShaper:  processStage<SignalGraph::Stage::preShaper>(block); break;
+            case SignalGraph::Stage::eq:         processStage<SignalGraph::Stage::eq>(block); break;
+            case SignalGraph::Stage::postShaper: processStage<SignalGraph::Stage::postShaper>(block); break;
+            case SignalGraph::Stage::ir:         processStage<SignalGraph::Stage::ir>(block); break;
+            case SignalGraph::Stage::outputGain: processStage<SignalGraph::Stage::outputGain>(block); break;
+            case SignalGraph::Stage::mix:        break;
+        }
+    }
+
+    static void applyGain(GainRamp& ramp, juce::dsp::AudioBlock<float>& block, LevelStats* inputLevels = nullptr)
+    {
+        float* channels[2];
+        const int numChannels = (int)juce::jmin(block.getNumChannels(), (size_t)2);
+        for (int channel = 0; channel < numChannels; ++channel)
+            channels[channel] = block.getChannelPointer((size_t)channel);
+
+        if (inputLevels != nullptr)
+            ramp.process(channels, numChannels, block.getNumSamples(), *inputLevels);
+        else
+            ramp.process(channels, numChannels, block.getNumSamples());
+    }
+
+    WaveshaperProcessor waveshaper;
+    ToneStack eq;
+    IRProcessor irProcessor;
+    SignalGraph graph;
+
+    std::atomic<float> gain{ 1.0f };
+    std::atomic<float> outputGain{ 1.0f };
+    GainRamp inputGainRamp;
+    GainRamp outputGainRamp;
+    LevelMeter inputMeter;
+    LevelMeter outputMeter;
+    StageProfiler profiler;
+    bool jumpToGainTargets = true;
+    bool monoProcessing = true;
+    int requestedInternalBlockSize = 0;
+    int internalBlockSize = maxInternalBlockSize;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AmpEngine)
+};
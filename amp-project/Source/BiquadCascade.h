@@ -0,0 +1,141 @@
+#pragma once
+#include <cstddef>
+#include "SIMDTarget.h"
+
+// A fixed chain of biquads run in a single pass, so each block goes through
+// memory once and every section's state stays in registers for the whole
+// block. Sections use the same transposed direct form II update, with the same
+// operation order, as juce::dsp::IIR::Filter. When there is more than one
+// channel the channels are packed into the lanes of a SIMD register and
+// filtered together.
+template <int numSections>
+class BiquadCascade
+{
+public:
+    // Normalised so that a0 == 1, in the order juce::dsp::IIR::Coefficients stores them
+    struct Section
+    {
+        float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    };
+
+    static constexpr int maxChannels = 4;
+
+    void setSection(int index, const Section& newSection) { sections[index] = newSection; }
+
+    void reset()
+    {
+        for (int k = 0; k < numSections; ++k)
+            for (int lane = 0; lane < maxChannels; ++lane)
+                state1[k][lane] = state2[k][lane] = 0.0f;
+    }
+
+    void process(float* const* channels, int numChannels, size_t numSamples)
+    {
+       #if AMP_SIMD_FLOAT4
+        if (numChannels > 1)
+        {
+            processLanes(channels, numChannels, numSamples);
+            return;
+        }
+       #endif
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            processChannel(channels[channel], channel, numSamples);
+    }
+
+private:
+    void processChannel(float* data, int channel, size_t numSamples)
+    {
+        // Local copies, so the compiler knows writes to data can't change them
+        Section c[numSections];
+        float s1[numSections], s2[numSections];
+        for (int k = 0; k < numSections; ++k)
+        {
+            c[k] = sections[k];
+            s1[k] = state1[k][channel];
+            s2[k] = state2[k][channel];
+        }
+
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            float x = data[i];
+            for (int k = 0; k < numSections; ++k)
+            {
+                const float y = (x * c[k].b0) + s1[k];
+                s1[k] = (x * c[k].b1) - (y * c[k].a1) + s2[k];
+                s2[k] = (x * c[k].b2) - (y * c[k].a2);
+                x = y;
+            }
+            data[i] = x;
+        }
+
+        for (int k = 0; k < numSections; ++k)
+        {
+            state1[k][channel] = snapToZero(s1[k]);
+            state2[k][channel] = snapToZero(s2[k]);
+        }
+    }
+
+   #if AMP_SIMD_FLOAT4
+    using Lanes = Float4::Type;
+
+    // One channel per lane; lanes past numChannels filter silence
+    void processLanes(float* const* channels, int numChannels, size_t numSamples)
+    {
+        Lanes b0[numSections], b1[numSections], b2[numSections], a1[numSections], a2[numSections];
+        Lanes s1[numSections], s2[numSections];
+        for (int k = 0; k < numSections; ++k)
+        {
+            b0[k] = Float4::broadcast(sections[k].b0);
+            b1[k] = Float4::broadcast(sections[k].b1);
+            b2[k] = Float4::broadcast(sections[k].b2);
+            a1[k] = Float4::broadcast(sections[k].a1);
+            a2[k] = Float4::broadcast(sections[k].a2);
+            s1[k] = Float4::load(state1[k]);
+            s2[k] = Float4::load(state2[k]);
+        }
+
+        alignas(16) float frame[maxChannels] = {};
+        for (size_t i = 0; i < numSamples; ++i)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                frame[channel] = channels[channel][i];
+
+            Lanes x = Float4::load(frame);
+            for (int k = 0; k < numSections; ++k)
+            {
+                const Lanes y = Float4::add(Float4::mul(x, b0[k]), s1[k]);
+                s1[k] = Float4::add(Float4::sub(Float4::mul(x, b1[k]), Float4::mul(y, a1[k])), s2[k]);
+                s2[k] = Float4::sub(Float4::mul(x, b2[k]), Float4::mul(y, a2[k]));
+                x = y;
+            }
+
+            alignas(16) float output[maxChannels];
+            Float4::store(output, x);
+            for (int channel = 0; channel < numChannels; ++channel)
+                channels[channel][i] = output[channel];
+        }
+
+        for (int k = 0; k < numSections; ++k)
+        {
+            Float4::store(state1[k], s1[k]);
+            Float4::store(state2[k], s2[k]);
+            for (int lane = 0; lane < maxChannels; ++lane)
+            {
+                state1[k][lane] = snapToZero(state1[k][lane]);
+                state2[k][lane] = snapToZero(state2[k][lane]);
+            }
+        }
+    }
+   #endif
+
+    // Same threshold juce::dsp::util::snapToZero uses, so decaying tails don't turn denormal
+    static float snapToZero(float value)
+    {
+        return (value < -1.0e-8f || value > 1.0e-8f) ? value : 0.0f;
+    }
+
+    Section sections[numSections];
+    alignas(16) float state1[numSections][maxChannels] = {};
+    alignas(16) float state2[numSections][maxChannels] = {};
+};
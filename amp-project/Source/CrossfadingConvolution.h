@@ -0,0 +1,419 @@
+#pragma once
+#include <JuceHeader.h>
+#include "IRCache.h"
+#include "PartitionedConvolution.h"
+
+// A convolution whose IR can be changed mid-song without a click. Every new IR
+// gets its own PartitionedConvolution, built on a worker thread. The audio
+// thread then runs the old and the new engine side by side for a short
+// equal-power crossfade and hands the old one back to the worker to delete,
+// so the extra cost is confined to the fade.
+class CrossfadingConvolution : private juce::Thread
+{
+public:
+    enum class Fade
+    {
+        output,     // Crossfade the two outputs; the old engine stops when the fade ends
+        input       // Crossfade what goes in, and let the old engine ring out its tail
+    };
+
+    CrossfadingConvolution(Fade fadeMode, bool passThroughWhenEmpty, double fadeSeconds)
+        : juce::Thread("IR loader"), fade(fadeMode), passThrough(passThroughWhenEmpty), fadeTime(fadeSeconds)
+    {
+    }
+
+    ~CrossfadingConvolution() override
+    {
+        stopThread(10000);
+        for (auto* engine : { current, next, ringing, toRetire, incoming.load(), retired.load() })
+            delete engine;
+    }
+
+    // Not while processing. Engines that are already loaded keep their IR,
+    // resampled if the rate has changed.
+
+    void prepare(const juce::dsp::ProcessSpec& spec)
+    {
+        bool engineIsZeroLatency = true;
+        {
+            // The worker publishes under this lock, so the queued engine can be re-prepared safely
+            const juce::ScopedLock sl(requestLock);
+            currentSpec = spec;
+            ++specGeneration;
+            engineIsZeroLatency = zeroLatency;
+
+            if (auto* engine = incoming.load(); hasConvolution(engine))
+                engine->prepare(spec, zeroLatency);
+        }
+
+        // Settle any fade in progress, the audio thread isn't looking
+        if (next != nullptr)
+        {
+            delete current;
+            current = next;
+            next = nullptr;
+        }
+        delete ringing;
+        delete toRetire;
+        ringing = toRetire = nullptr;
+
+        if (hasConvolution(current))
+            current->prepare(spec, engineIsZeroLatency);
+        latency = engineIsZeroLatency ? 0 : PartitionedConvolution::getHeadSize(spec);
+
+        fadeLength = juce::jmax(1, juce::roundToInt(fadeTime * spec.sampleRate));
+        fadeTable.resize((size_t)fadeLength + 1);
+        for (int i = 0; i <= fadeLength; ++i)
+            fadeTable[(size_t)i] = std::sin(juce::MathConstants<float>::halfPi * (float)i / (float)fadeLength);
+
+        otherBuffer.setSize((int)spec.numChannels, (int)spec.maximumBlockSize, false, true, false);
+        fadePosition = 0;
+
+        if (!isThreadRunning())
+            startThread();
+    }
+
+    // Control thread. The IR must already be trimmed and normalised.
+    void load(juce::AudioBuffer<float>&& impulseResponse, double sampleRate)
+    {
+        auto request = std::make_unique<Request>();
+        request->buffer = std::move(impulseResponse);
+        request->sampleRate = sampleRate;
+        post(std::move(request));
+    }
+
+    // Control thread. Decodes, trims and normalises the file on the worker.
+    void load(const juce::File& file, IRCache::Preprocessing preprocessing = {})
+    {
+        auto request = std::make_unique<Request>();
+        request->file = file;
+        request->preprocessing = preprocessing;
+        post(std::move(request));
+    }
+
+    // Control thread. Fades to silence, or to the dry signal if passThroughWhenEmpty.
+    void clear()
+    {
+        post(std::make_unique<Request>());
+    }
+
+    // For offline use, while nothing is processing: waits for the last load
+    // and installs it directly, without a fade.
+    bool finishPendingLoad(int timeoutMs)
+    {
+        const auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32)timeoutMs;
+        for (;;)
+        {
+            {
+                const juce::ScopedLock sl(requestLock);
+                if (request == nullptr && !building)
+                    break;
+            }
+
+            if (juce::Time::getMillisecondCounter() > deadline)
+                return false;
+            juce::Thread::sleep(1);
+        }
+
+        if (auto* engine = incoming.exchange(nullptr))
+        {
+            for (auto* old : { current, next, ringing, toRetire })
+                delete old;
+            current = engine;
+            next = ringing = toRetire = nullptr;
+        }
+
+        if (hasConvolution(current))
+            current->convolution->reset();
+        return true;
+    }
+
+    // Audio thread
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        crossfadedLastBlock = false;
+        handOverRetired();
+
+        if (next == nullptr && ringing == nullptr && toRetire == nullptr)
+        {
+            if (auto* engine = incoming.exchange(nullptr))
+            {
+                next = engine;
+                fadePosition = 0;
+            }
+        }
+
+        // An engine that starts ringing in this block has already run over it
+        // inside crossfade(), so its tail starts with the next block
+        const bool wasRinging = ringing != nullptr;
+        if (next != nullptr)
+            crossfade(block);
+        else
+            convolve(current, block);
+
+        if (wasRinging)
+            ringOut(block);
+    }
+
+    // Lets the engines run their channels on the pool's threads. Not while processing.
+    void setWorkerPool(RealtimeWorkerPool* newPool) { workerPool = newPool; }
+
+    // Audio thread. False while there is nothing to convolve and nothing on its way.
+    bool isActive() const
+    {
+        return hasConvolution(current) || next != nullptr || ringing != nullptr || incoming.load() != nullptr;
+    }
+
+    // Audio thread. True if either engine involved has a stereo IR.
+    bool needsStereo() const
+    {
+        return isStereo(current) || isStereo(next) || isStereo(ringing);
+    }
+
+    // Audio thread. Lets the stress harness single out the callbacks that paid for a swap.
+    bool didCrossfadeInLastBlock() const { return crossfadedLastBlock; }
+
+    // Without zero latency the engines skip their FIR head and run one FFT
+    // partition behind. Takes effect at the next prepare().
+    void setZeroLatency(bool shouldBeZeroLatency)
+    {
+        const juce::ScopedLock sl(requestLock);
+        zeroLatency = shouldBeZeroLatency;
+    }
+
+    // In samples, as of the last prepare()
+    int getLatency() const { return latency; }
+
+private:
+    struct Engine
+    {
+        // Not real-time
+        void prepare(const juce::dsp::ProcessSpec& spec, bool zeroLatency)
+        {
+            if (spec.sampleRate != sampleRate)
+            {
+                impulse = IRCache::resample(std::move(impulse), sampleRate, spec.sampleRate);
+                sampleRate = spec.sampleRate;
+            }
+
+            convolution->prepare(spec, impulse, zeroLatency);
+            length = impulse.getNumSamples();
+        }
+
+        std::unique_ptr<PartitionedConvolution> convolution;
+        juce::AudioBuffer<float> impulse;
+        double sampleRate = 0.0;
+        int numChannels = 0;
+        int length = 0;
+    };
+
+    struct Request
+    {
+        juce::AudioBuffer<float> buffer;
+        double sampleRate = 0.0;
+        juce::File file;
+        IRCache::Preprocessing preprocessing;
+    };
+
+    static bool hasConvolution(const Engine* engine) { return engine != nullptr && engine->convolution != nullptr; }
+    static bool isStereo(const Engine* engine) { return engine != nullptr && engine->numChannels > 1; }
+
+    void post(std::unique_ptr<Request> newRequest)
+    {
+        {
+            const juce::ScopedLock sl(requestLock);
+            request = std::move(newRequest);
+        }
+        notify();
+    }
+
+    void convolve(Engine* engine, juce::dsp::AudioBlock<float>& block)
+    {
+        if (!hasConvolution(engine))
+        {
+            if (!passThrough)
+                block.clear();
+            return;
+        }
+
+        engine->convolution->process(block, workerPool);
+    }
+
+    void crossfade(juce::dsp::AudioBlock<float>& block)
+    {
+        crossfadedLastBlock = true;
+        const size_t numSamples = block.getNumSamples();
+        auto other = juce::dsp::AudioBlock<float>(otherBuffer)
+                         .getSubsetChannelBlock(0, block.getNumChannels())
+                         .getSubBlock(0, numSamples);
+        other.copyFrom(block);
+
+        if (fade == Fade::input)
+        {
+            applyFade(block, other);
+            convolve(current, block);
+            convolve(next, other);
+            block.add(other);
+        }
+        else
+        {
+            convolve(current, block);
+            convolve(next, other);
+            applyFade(block, other);
+            block.add(other);
+        }
+
+        fadePosition += (int)numSamples;
+        if (fadePosition < fadeLength)
+            return;
+
+        // The input fade has stopped feeding the old engine, but its tail still has to come out
+        if (fade == Fade::input && hasConvolution(current))
+        {
+            ringing = current;
+            ringRemaining = current->length;
+        }
+        else
+        {
+            toRetire = current;
+        }
+
+        current = next;
+        next = nullptr;
+    }
+
+    // oldBlock *= cos, newBlock *= sin, from the fade table
+    void applyFade(juce::dsp::AudioBlock<float>& oldBlock, juce::dsp::AudioBlock<float>& newBlock) const
+    {
+        for (size_t channel = 0; channel < oldBlock.getNumChannels(); ++channel)
+        {
+            auto* oldData = oldBlock.getChannelPointer(channel);
+            auto* newData = newBlock.getChannelPointer(channel);
+            for (size_t i = 0; i < oldBlock.getNumSamples(); ++i)
+            {
+                const int position = juce::jmin(fadeLength, fadePosition + (int)i);
+                oldData[i] *= fadeTable[(size_t)(fadeLength - position)];
+                newData[i] *= fadeTable[(size_t)position];
+            }
+        }
+    }
+
+    void ringOut(juce::dsp::AudioBlock<float>& block)
+    {
+        auto tail = juce::dsp::AudioBlock<float>(otherBuffer)
+                        .getSubsetChannelBlock(0, block.getNumChannels())
+                        .getSubBlock(0, block.getNumSamples());
+        tail.clear();
+        convolve(ringing, tail);
+        block.add(tail);
+
+        ringRemaining -= (int)block.getNumSamples();
+        if (ringRemaining <= 0 && toRetire == nullptr)
+        {
+            toRetire = ringing;
+            ringing = nullptr;
+        }
+    }
+
+    // Engines are never freed on the audio thread; the worker picks them up from here
+    void handOverRetired()
+    {
+        if (toRetire != nullptr && retired.load() == nullptr)
+        {
+            retired.store(toRetire);
+            toRetire = nullptr;
+        }
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            delete retired.exchange(nullptr);
+
+            std::unique_ptr<Request> job;
+            juce::dsp::ProcessSpec spec;
+            int generation = 0;
+            bool engineIsZeroLatency = true;
+            {
+                const juce::ScopedLock sl(requestLock);
+                job = std::move(request);
+                building = job != nullptr;
+                spec = currentSpec;
+                generation = specGeneration;
+                engineIsZeroLatency = zeroLatency;
+            }
+
+            if (job == nullptr)
+            {
+                wait(20);
+                continue;
+            }
+
+            auto engine = build(*job, spec, engineIsZeroLatency);
+            {
+                const juce::ScopedLock sl(requestLock);
+                if (generation != specGeneration && hasConvolution(engine.get()))
+                    engine->prepare(currentSpec, zeroLatency);
+                delete incoming.exchange(engine.release());
+                building = false;
+            }
+        }
+    }
+
+    std::unique_ptr<Engine> build(Request& job, const juce::dsp::ProcessSpec& spec, bool engineIsZeroLatency)
+    {
+        auto engine = std::make_unique<Engine>();
+
+        if (job.file != juce::File())
+        {
+            auto prepared = IRCache::prepareImpulseResponse(job.file, spec.sampleRate, job.preprocessing);
+            if (prepared == nullptr)
+                return engine;
+            job.buffer = prepared->buffer;
+            job.sampleRate = prepared->sampleRate;
+        }
+
+        if (job.buffer.getNumSamples() == 0)
+            return engine;
+
+        engine->numChannels = job.buffer.getNumChannels();
+        engine->impulse = std::move(job.buffer);
+        engine->sampleRate = job.sampleRate;
+        engine->convolution = std::make_unique<PartitionedConvolution>();
+        engine->prepare(spec, engineIsZeroLatency);
+        return engine;
+    }
+
+    const Fade fade;
+    const bool passThrough;
+    const double fadeTime;
+    RealtimeWorkerPool* workerPool = nullptr;
+
+    // Worker side
+    juce::CriticalSection requestLock;
+    std::unique_ptr<Request> request;
+    bool building = false;
+    juce::dsp::ProcessSpec currentSpec{ 44100.0, 512, 2 };
+    int specGeneration = 0;
+    bool zeroLatency = true;
+
+    // Handoff, one slot each way
+    std::atomic<Engine*> incoming{ nullptr };
+    std::atomic<Engine*> retired{ nullptr };
+
+    // Audio side
+    Engine* current = nullptr;
+    Engine* next = nullptr;
+    Engine* ringing = nullptr;
+    Engine* toRetire = nullptr;
+    juce::AudioBuffer<float> otherBuffer;
+    std::vector<float> fadeTable;
+    int fadeLength = 1;
+    int fadePosition = 0;
+    int ringRemaining = 0;
+    int latency = 0;
+    bool crossfadedLastBlock = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CrossfadingConvolution)
+};
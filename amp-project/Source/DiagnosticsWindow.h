@@ -0,0 +1,236 @@
+#pragma once
+#include <JuceHeader.h>
+#include <deque>
+#include "StageProfiler.h"
+
+// Drains the engine's StageProfiler ten times a second. It shows each stage's
+// share of real time over the last second, how much of its deadline the
+// callback used, and how many callbacks overran. The full history can be
+// saved as CSV to attach to a bug report.
+class DiagnosticsComponent : public juce::Component, private juce::Timer
+{
+public:
+    DiagnosticsComponent(StageProfiler& source, juce::AudioDeviceManager& devices)
+        : profiler(source), deviceManager(devices)
+    {
+        // Whatever piled up while nobody was looking says nothing about now
+        while (profiler.pop(scratch.data(), (int)scratch.size()) > 0)
+        {
+        }
+        profiler.takeNumDropped();
+        xrunBaseline = deviceManager.getXRunCount();
+
+        addAndMakeVisible(exportButton);
+        exportButton.setEnabled(StageProfiler::enabled);
+        exportButton.onClick = [this]() { chooseCsvFile(); };
+
+        addAndMakeVisible(resetButton);
+        resetButton.onClick = [this]()
+        {
+            history.clear();
+            numOverruns = 0;
+            numDropped = 0;
+            xrunBaseline = deviceManager.getXRunCount();
+            repaint();
+        };
+
+        setSize(480, 360);
+        startTimerHz(10);
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        g.fillAll(juce::Colours::black);
+        g.setColour(juce::Colours::white);
+        g.setFont(15.0f);
+
+        auto area = getLocalBounds().reduced(12);
+        area.removeFromBottom(40);
+
+        if (!StageProfiler::enabled)
+        {
+            g.drawText("Profiling was compiled out of this build (AMP_PROFILING=0)", area, juce::Justification::centred);
+            return;
+        }
+
+        auto line = [&area]() { return area.removeFromTop(22); };
+        g.drawText("Callback: " + juce::String(averageShare * 100.0, 1) + "% of deadline on average, "
+                       + juce::String(peakShare * 100.0, 1) + "% at peak",
+                   line(), juce::Justification::centredLeft);
+        g.drawText("Overruns: " + juce::String(numOverruns)
+                       + "   Device xruns: " + juce::String(deviceManager.getXRunCount() - xrunBaseline)
+                       + "   Dropped frames: " + juce::String(numDropped),
+                   line(), juce::Justification::centredLeft);
+        area.removeFromTop(10);
+
+        for (int slot = 0; slot <= StageProfiler::numSlots; ++slot)
+        {
+            auto row = line();
+            const bool isOther = slot == StageProfiler::numSlots;
+            const double load = isOther ? otherLoad : stageLoads[(size_t)slot];
+
+            g.setColour(juce::Colours::white);
+            g.drawText(isOther ? "other" : StageProfiler::getSlotName(slot), row.removeFromLeft(60), juce::Justification::centredLeft);
+            g.drawText(juce::String(load * 100.0, 2) + " %", row.removeFromRight(70), juce::Justification::centredRight);
+
+            auto bar = row.reduced(4, 5).toFloat();
+            g.setColour(juce::Colours::darkgrey);
+            g.fillRect(bar);
+            g.setColour(load > 0.5 ? juce::Colours::red : juce::Colours::limegreen);
+            g.fillRect(bar.withWidth(bar.getWidth() * (float)juce::jlimit(0.0, 1.0, load)));
+        }
+    }
+
+    void resized() override
+    {
+        auto buttons = getLocalBounds().reduced(12).removeFromBottom(30);
+        exportButton.setBounds(buttons.removeFromLeft(120));
+        buttons.removeFromLeft(10);
+        resetButton.setBounds(buttons.removeFromLeft(80));
+    }
+
+private:
+    static constexpr size_t maxHistory = 60000;     // About ten minutes of 10 ms callbacks
+    static constexpr double statsSeconds = 1.0;
+
+    void timerCallback() override
+    {
+        const double sampleRate = profiler.getSampleRate();
+        int count;
+        while ((count = profiler.pop(scratch.data(), (int)scratch.size())) > 0)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                const auto& frame = scratch[(size_t)i];
+                if (frame.numSamples == 0)
+                    continue;
+
+                if (juce::Time::highResolutionTicksToSeconds(frame.callbackTicks) > frame.numSamples / sampleRate)
+                    ++numOverruns;
+
+                history.push_back(frame);
+            }
+        }
+
+        while (history.size() > maxHistory)
+            history.pop_front();
+
+        numDropped += profiler.takeNumDropped();
+        updateStats(sampleRate);
+        repaint();
+    }
+
+    // Loads are shares of real time over the most recent statsSeconds of audio
+    void updateStats(double sampleRate)
+    {
+        std::array<juce::int64, StageProfiler::numSlots> stageTicks{};
+        juce::int64 callbackTicks = 0;
+        double audioSeconds = 0.0, shareTotal = 0.0;
+        int numFrames = 0;
+        peakShare = 0.0;
+
+        for (auto it = history.rbegin(); it != history.rend() && audioSeconds < statsSeconds; ++it)
+        {
+            const double deadline = it->numSamples / sampleRate;
+            const double share = juce::Time::highResolutionTicksToSeconds(it->callbackTicks) / deadline;
+            peakShare = juce::jmax(peakShare, share);
+            shareTotal += share;
+            audioSeconds += deadline;
+            callbackTicks += it->callbackTicks;
+            for (size_t slot = 0; slot < stageTicks.size(); ++slot)
+                stageTicks[slot] += it->stageTicks[slot];
+            ++numFrames;
+        }
+
+        averageShare = numFrames > 0 ? shareTotal / numFrames : 0.0;
+        juce::int64 stagesTotal = 0;
+        for (size_t slot = 0; slot < stageTicks.size(); ++slot)
+        {
+            stageLoads[slot] = audioSeconds > 0.0 ? juce::Time::highResolutionTicksToSeconds(stageTicks[slot]) / audioSeconds : 0.0;
+            stagesTotal += stageTicks[slot];
+        }
+        otherLoad = audioSeconds > 0.0 ? juce::Time::highResolutionTicksToSeconds(callbackTicks - stagesTotal) / audioSeconds : 0.0;
+    }
+
+    void chooseCsvFile()
+    {
+        chooser = std::make_unique<juce::FileChooser>("Export profile", juce::File::getSpecialLocation(juce::File::userDocumentsDirectory).getChildFile("amp-profile.csv"), "*.csv");
+        chooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles | juce::FileBrowserComponent::warnAboutOverwriting,
+            [this](const juce::FileChooser& fc)
+            {
+                const auto file = fc.getResult();
+                if (file != juce::File() && !writeCsv(file))
+                    juce::AlertWindow::showMessageBoxAsync(juce::MessageBoxIconType::WarningIcon, "Export profile", "Could not write " + file.getFullPathName());
+            });
+    }
+
+    bool writeCsv(const juce::File& file) const
+    {
+        file.deleteFile();
+        auto stream = file.createOutputStream();
+        if (stream == nullptr)
+            return false;
+
+        const double sampleRate = profiler.getSampleRate();
+        auto toMs = [](juce::int64 ticks) { return juce::String(juce::Time::highResolutionTicksToSeconds(ticks) * 1000.0, 4); };
+
+        *stream << "callback,start_ms,samples,deadline_ms,callback_ms";
+        for (int slot = 0; slot < StageProfiler::numSlots; ++slot)
+            *stream << "," << StageProfiler::getSlotName(slot) << "_ms";
+        *stream << "\n";
+
+        const juce::int64 firstStart = history.empty() ? 0 : history.front().startTicks;
+        int index = 0;
+        for (const auto& frame : history)
+        {
+            *stream << juce::String(index++) << "," << toMs(frame.startTicks - firstStart) << "," << juce::String(frame.numSamples) << ","
+                    << juce::String(1000.0 * frame.numSamples / sampleRate, 4) << "," << toMs(frame.callbackTicks);
+            for (auto ticks : frame.stageTicks)
+                *stream << "," << toMs(ticks);
+            *stream << "\n";
+        }
+
+        return true;
+    }
+
+    StageProfiler& profiler;
+    juce::AudioDeviceManager& deviceManager;
+    std::array<StageProfiler::Frame, 256> scratch;
+    std::deque<StageProfiler::Frame> history;
+
+    std::array<double, StageProfiler::numSlots> stageLoads{};
+    double otherLoad = 0.0;
+    double averageShare = 0.0;
+    double peakShare = 0.0;
+    int numOverruns = 0;
+    int numDropped = 0;
+    int xrunBaseline = 0;
+
+    juce::TextButton exportButton{ "Export CSV..." };
+    juce::TextButton resetButton{ "Reset" };
+    std::unique_ptr<juce::FileChooser> chooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DiagnosticsComponent)
+};
+
+class DiagnosticsWindow : public juce::DocumentWindow
+{
+public:
+    DiagnosticsWindow(const juce::String& name, StageProfiler& profiler, juce::AudioDeviceManager& deviceManager)
+        : juce::DocumentWindow(name, juce::Colours::black, DocumentWindow::closeButton)
+    {
+        setUsingNativeTitleBar(true);
+        setContentOwned(new DiagnosticsComponent(profiler, deviceManager), true);
+        setResizable(true, true);
+        centreWithSize(480, 360);
+    }
+
+    void closeButtonPressed() override
+    {
+        setVisible(false);
+        delete this;
+    }
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DiagnosticsWindow)
+};
@@ -0,0 +1,303 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include "SIMDTarget.h"
+#include "LevelMeter.h"
+
+// A gain that glides to each new target over a fixed time instead of jumping
+// at the block boundary, applied sample by sample. Exponential ramps move
+// evenly across a gain knob's range but need both ends above zero, so ramps
+// to or from silence are linear. Once the target is reached the gain is a
+// plain vector multiply.
+class GainRamp
+{
+public:
+    enum class Shape { linear, exponential };
+
+    explicit GainRamp(Shape rampShape = Shape::exponential) : shape(rampShape) {}
+
+    void reset(double sampleRate, double rampSeconds)
+    {
+        rampLength = std::max(1, (int)std::lround(sampleRate * rampSeconds));
+        setCurrentAndTarget(target);
+    }
+
+    void setCurrentAndTarget(float value)
+    {
+        current = target = value;
+        remaining = 0;
+    }
+
+    // Starts a new ramp from wherever the gain is now
+    void setTarget(float newTarget)
+    {
+        if (newTarget == target)
+            return;
+
+        target = newTarget;
+        remaining = rampLength;
+        exponential = shape == Shape::exponential && current > 0.0f && target > 0.0f;
+        step = exponential ? std::pow(target / current, 1.0f / (float)rampLength)
+                           : (target - current) / (float)rampLength;
+    }
+
+    bool isSmoothing() const { return remaining > 0; }
+
+    // Applies the same gain curve to every channel, then moves it on by numSamples
+    void process(float* const* channels, int numChannels, size_t numSamples)
+    {
+        NoLevels levels;
+        processChannels(channels, numChannels, numSamples, levels);
+    }
+
+    // The same, also measuring the samples on their way in
+    void process(float* const* channels, int numChannels, size_t numSamples, LevelStats& inputLevels)
+    {
+        LevelAccumulator levels(inputLevels);
+        processChannels(channels, numChannels, numSamples, levels);
+    }
+
+    // out = out * this gain + in * inGain's gain in a single pass, then moves
+    // both ramps on by numSamples. in may be out itself.
+    void mix(float* const* out, const float* const* in, int numChannels, size_t numSamples, GainRamp& inGain)
+    {
+        mixChannels(out, in, numChannels, numSamples, this, inGain);
+    }
+
+    // out += in * gain in a single pass, then moves the ramp on by numSamples
+    void addFrom(float* const* out, const float* const* in, int numChannels, size_t numSamples)
+    {
+        mixChannels(out, in, numChannels, numSamples, nullptr, *this);
+    }
+
+    // Moves the ramp on as if numSamples had been processed
+    void skip(size_t numSamples)
+    {
+        advance(std::min(numSamples, (size_t)remaining));
+    }
+
+    // Settled at exactly this gain, so applying it would be a wasted pass
+    bool isSteadyAt(float gain) const { return remaining == 0 && target == gain; }
+
+private:
+    // The gain over part of a block: start * step^i, or start + step * i
+    struct Curve
+    {
+        float start = 1.0f;
+        float step = 0.0f;
+        bool exponential = false;
+
+        float at(size_t i) const { return exponential ? start * std::pow(step, (float)i) : start + step * (float)i; }
+    };
+
+    // The curve from offset samples into a block where the ramp runs for rampSamples
+    Curve curveFrom(size_t offset, size_t rampSamples) const
+    {
+        if (offset >= rampSamples)
+            return { target, 0.0f, false };
+
+        Curve curve{ current, step, exponential };
+        curve.start = curve.at(offset);
+        return curve;
+    }
+
+    template <typename Levels>
+    void processChannels(float* const* channels, int numChannels, size_t numSamples, Levels& levels)
+    {
+        const size_t rampSamples = std::min(numSamples, (size_t)remaining);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            float* data = channels[channel];
+            if (rampSamples > 0)
+            {
+                if (exponential)
+                    multiplyExponential(data, rampSamples, current, step, levels);
+                else
+                    multiplyLinear(data, rampSamples, current, step, levels);
+            }
+
+            multiplyConstant(data + rampSamples, numSamples - rampSamples, target, levels);
+            levels.finish(numSamples);
+        }
+
+        advance(rampSamples);
+    }
+
+    void advance(size_t rampSamples)
+    {
+        if (rampSamples == 0)
+            return;
+
+        remaining -= (int)rampSamples;
+        if (remaining == 0)
+            current = target;
+        else
+            current = exponential ? current * std::pow(step, (float)rampSamples) : current + step * (float)rampSamples;
+    }
+
+    // outGain == nullptr leaves out at unity. Each channel is split where either
+    // ramp ends, so both gains follow a single curve within each piece.
+    static void mixChannels(float* const* out, const float* const* in, int numChannels, size_t numSamples,
+                            GainRamp* outGain, GainRamp& inGain)
+    {
+        const size_t outRamp = outGain != nullptr ? std::min(numSamples, (size_t)outGain->remaining) : 0;
+        const size_t inRamp = std::min(numSamples, (size_t)inGain.remaining);
+        const size_t splits[] = { 0, std::min(outRamp, inRamp), std::max(outRamp, inRamp), numSamples };
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            for (int piece = 0; piece < 3; ++piece)
+            {
+                const size_t begin = splits[piece], length = splits[piece + 1] - begin;
+                if (length == 0)
+                    continue;
+
+                const Curve outCurve = outGain != nullptr ? outGain->curveFrom(begin, outRamp) : Curve{};
+                mixCurves(out[channel] + begin, in[channel] + begin, length, outCurve, inGain.curveFrom(begin, inRamp));
+            }
+        }
+
+        if (outGain != nullptr && outGain != &inGain)
+            outGain->advance(outRamp);
+        inGain.advance(inRamp);
+    }
+
+    static void mixCurves(float* out, const float* in, size_t numSamples, Curve outCurve, Curve inCurve)
+    {
+        size_t i = 0;
+       #if AMP_SIMD_FLOAT4
+        Lanes outGains(outCurve), inGains(inCurve);
+        for (; i + 4 <= numSamples; i += 4)
+            Float4::store(out + i, Float4::add(Float4::mul(Float4::load(out + i), outGains.next()),
+                                               Float4::mul(Float4::load(in + i), inGains.next())));
+       #endif
+
+        for (; i < numSamples; ++i)
+            out[i] = out[i] * outCurve.at(i) + in[i] * inCurve.at(i);
+    }
+
+   #if AMP_SIMD_FLOAT4
+    // Four consecutive gains of a curve at a time
+    struct Lanes
+    {
+        explicit Lanes(const Curve& curve) : exponential(curve.exponential)
+        {
+            const float s = curve.start, r = curve.step;
+            if (exponential)
+            {
+                gains = Float4::set(s, s * r, s * r * r, s * r * r * r);
+                advance = Float4::broadcast(r * r * r * r);
+            }
+            else
+            {
+                starts = Float4::broadcast(s);
+                steps = Float4::broadcast(r);
+                index = Float4::set(0.0f, 1.0f, 2.0f, 3.0f);
+                advance = Float4::broadcast(4.0f);
+            }
+        }
+
+        Float4::Type next()
+        {
+            if (exponential)
+            {
+                const auto result = gains;
+                gains = Float4::mul(gains, advance);
+                return result;
+            }
+
+            const auto result = Float4::add(starts, Float4::mul(steps, index));
+            index = Float4::add(index, advance);
+            return result;
+        }
+
+        bool exponential;
+        Float4::Type gains{}, starts{}, steps{}, index{}, advance{};
+    };
+   #endif
+
+    template <typename Levels>
+    static void multiplyConstant(float* data, size_t numSamples, float gain, Levels& levels)
+    {
+        size_t i = 0;
+       #if AMP_SIMD_FLOAT4
+        const auto gains = Float4::broadcast(gain);
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            const auto samples = Float4::load(data + i);
+            levels.add(samples);
+            Float4::store(data + i, Float4::mul(samples, gains));
+        }
+       #endif
+
+        for (; i < numSamples; ++i)
+        {
+            levels.add(data[i]);
+            data[i] *= gain;
+        }
+    }
+
+    // gain[i] = start + i * step, with i counted exactly in every lane
+    template <typename Levels>
+    static void multiplyLinear(float* data, size_t numSamples, float start, float step, Levels& levels)
+    {
+        size_t i = 0;
+       #if AMP_SIMD_FLOAT4
+        const auto starts = Float4::broadcast(start);
+        const auto steps = Float4::broadcast(step);
+        const auto four = Float4::broadcast(4.0f);
+        auto index = Float4::set(0.0f, 1.0f, 2.0f, 3.0f);
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            const auto gains = Float4::add(starts, Float4::mul(steps, index));
+            const auto samples = Float4::load(data + i);
+            levels.add(samples);
+            Float4::store(data + i, Float4::mul(samples, gains));
+            index = Float4::add(index, four);
+        }
+       #endif
+
+        for (; i < numSamples; ++i)
+        {
+            levels.add(data[i]);
+            data[i] *= start + step * (float)i;
+        }
+    }
+
+    // gain[i] = start * ratio^i, four lanes advanced by ratio^4 at a time
+    template <typename Levels>
+    static void multiplyExponential(float* data, size_t numSamples, float start, float ratio, Levels& levels)
+    {
+        size_t i = 0;
+       #if AMP_SIMD_FLOAT4
+        const float ratio2 = ratio * ratio;
+        auto gains = Float4::set(start, start * ratio, start * ratio2, start * ratio2 * ratio);
+        const auto ratio4 = Float4::broadcast(ratio2 * ratio2);
+        for (; i + 4 <= numSamples; i += 4)
+        {
+            const auto samples = Float4::load(data + i);
+            levels.add(samples);
+            Float4::store(data + i, Float4::mul(samples, gains));
+            gains = Float4::mul(gains, ratio4);
+        }
+       #endif
+
+        float gain = start * std::pow(ratio, (float)i);
+        for (; i < numSamples; ++i)
+        {
+            levels.add(data[i]);
+            data[i] *= gain;
+            gain *= ratio;
+        }
+    }
+
+    Shape shape;
+    bool exponential = false;
+    int rampLength = 1;
+    int remaining = 0;
+    float current = 1.0f;
+    float target = 1.0f;
+    float step = 0.0f;
+};
@@ -0,0 +1,378 @@
+#pragma once
+#include <JuceHeader.h>
+#include <map>
+#include <set>
+
+// Impulse responses decoded once and kept in memory, ready for the convolution
+// at the device rate. A background pool decodes, trims, resamples, shortens and
+// normalises every file it is asked to preload, so switching IRs or profiles
+// only copies from RAM. Once the total passes the memory budget the least
+// recently used entries are dropped.
+class IRCache
+{
+public:
+    // One prepared IR. It stays valid while referenced, even after eviction.
+    struct Entry : public juce::ReferenceCountedObject
+    {
+        using Ptr = juce::ReferenceCountedObjectPtr<Entry>;
+
+        juce::AudioBuffer<float> buffer;
+        double sampleRate = 0.0;
+
+        // What preprocessing saved, at sampleRate: the file's length against the
+        // buffer's, and where the peak sat before and after
+        int originalTaps = 0;
+        int originalPeakDelay = 0;
+        int peakDelay = 0;
+
+        int getTapsSaved() const { return originalTaps - buffer.getNumSamples(); }
+        int getLatencySaved() const { return originalPeakDelay - peakDelay; }
+
+        size_t getSizeInBytes() const { return (size_t)buffer.getNumChannels() * (size_t)buffer.getNumSamples() * sizeof(float); }
+    };
+
+    // How an IR is shortened beyond trimming silence. Part of the cache key.
+    struct Preprocessing
+    {
+        // The tail is cut where the energy still to come falls this far below the
+        // total. 0 keeps the whole IR.
+        float tailCutoffDb = -60.0f;
+
+        // Rebuilds the IR with the same magnitude response but all its energy as
+        // early as possible, which removes pre-delay and lets the cutoff take more.
+        // Fine for cabinets, wrong for rooms. IRs longer than
+        // maxMinimumPhaseLength are left as they are.
+        bool minimumPhase = false;
+    };
+
+    // About 2.7 seconds at 48 kHz, far longer than any cabinet. The 8x padded
+    // FFT for it is 2^20 points.
+    static constexpr int maxMinimumPhaseLength = 1 << 17;
+
+    static constexpr size_t defaultMemoryBudget = 128 * 1024 * 1024;
+
+    explicit IRCache(size_t memoryBudgetBytes = defaultMemoryBudget, int numThreads = 2)
+        : pool(numThreads), memoryBudget(memoryBudgetBytes)
+    {
+    }
+
+    ~IRCache()
+    {
+        pool.removeAllJobs(true, 10000);
+    }
+
+    void setMemoryBudget(size_t bytes)
+    {
+        const juce::ScopedLock sl(lock);
+        memoryBudget = bytes;
+        evictOverBudget({});
+    }
+
+    size_t getMemoryUsage() const
+    {
+        const juce::ScopedLock sl(lock);
+        return memoryUsage;
+    }
+
+    // Queues every file that isn't cached or on its way yet. Returns immediately.
+    void preload(const juce::Array<juce::File>& files, double sampleRate, Preprocessing preprocessing = {})
+    {
+        for (const auto& file : files)
+        {
+            const auto key = makeKey(file, sampleRate, preprocessing);
+            {
+                const juce::ScopedLock sl(lock);
+                if (entries.count(key) > 0 || pending.count(key) > 0)
+                    continue;
+                pending.insert(key);
+            }
+
+            pool.addJob([this, file, sampleRate, preprocessing, key]()
+            {
+                insert(key, prepareImpulseResponse(file, sampleRate, preprocessing));
+                return juce::ThreadPoolJob::jobHasFinished;
+            });
+        }
+    }
+
+    // The IR prepared for sampleRate. A file still being preloaded is waited
+    // for; one that was never queued is decoded on the calling thread.
+    // Returns nullptr if the file can't be read.
+    Entry::Ptr get(const juce::File& file, double sampleRate, Preprocessing preprocessing = {})
+    {
+        const auto key = makeKey(file, sampleRate, preprocessing);
+
+        for (;;)
+        {
+            {
+                const juce::ScopedLock sl(lock);
+                auto found = entries.find(key);
+                if (found != entries.end())
+                {
+                    found->second.lastUsed = ++useCounter;
+                    return found->second.entry;
+                }
+
+                // Claim it, so other callers wait for this decode rather than repeating it
+                if (pending.insert(key).second)
+                    break;
+            }
+
+            entryFinished.wait(50);
+        }
+
+        auto entry = prepareImpulseResponse(file, sampleRate, preprocessing);
+        insert(key, entry);
+        return entry;
+    }
+
+    // Decode, trim silence, resample to sampleRate and normalise, the same
+    // steps juce::dsp::Convolution takes with Trim::yes and Normalise::yes, then
+    // shorten as preprocessing asks
+    static Entry::Ptr prepareImpulseResponse(const juce::File& file, double sampleRate, Preprocessing preprocessing = {})
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return nullptr;
+
+        const int numChannels = juce::jlimit(1, 2, (int)reader->numChannels);
+        juce::AudioBuffer<float> decoded(numChannels, (int)reader->lengthInSamples);
+        reader->read(&decoded, 0, decoded.getNumSamples(), 0, true, numChannels > 1);
+
+        Entry::Ptr entry = new Entry();
+        entry->buffer = resample(trimSilence(decoded), reader->sampleRate, sampleRate);
+        entry->sampleRate = sampleRate;
+        entry->originalTaps = juce::roundToInt((double)reader->lengthInSamples * sampleRate / reader->sampleRate);
+        entry->originalPeakDelay = findPeak(resample(decoded, reader->sampleRate, sampleRate));
+
+        if (preprocessing.minimumPhase)
+            makeMinimumPhase(entry->buffer);
+        if (preprocessing.tailCutoffDb < 0.0f)
+            cutTail(entry->buffer, preprocessing.tailCutoffDb);
+
+        entry->peakDelay = findPeak(entry->buffer);
+        normalise(entry->buffer);
+        return entry;
+    }
+
+    // Band-limited resampling of a whole buffer; returns it untouched if the rates match
+    static juce::AudioBuffer<float> resample(juce::AudioBuffer<float> buffer, double sourceRate, double targetRate)
+    {
+        if (sourceRate == targetRate)
+            return buffer;
+
+        const double ratio = sourceRate / targetRate;
+        const int resampledLength = juce::roundToInt(juce::jmax(1.0, buffer.getNumSamples() / ratio));
+
+        juce::MemoryAudioSource memorySource(buffer, false);
+        juce::ResamplingAudioSource resamplingSource(&memorySource, false, buffer.getNumChannels());
+        resamplingSource.setResamplingRatio(ratio);
+        resamplingSource.prepareToPlay(resampledLength, sourceRate);
+
+        juce::AudioBuffer<float> resampled(buffer.getNumChannels(), resampledLength);
+        resamplingSource.getNextAudioBlock({ &resampled, 0, resampledLength });
+        return resampled;
+    }
+
+private:
+    struct Slot
+    {
+        Entry::Ptr entry;
+        juce::uint64 lastUsed = 0;
+    };
+
+    static juce::String makeKey(const juce::File& file, double sampleRate, const Preprocessing& preprocessing)
+    {
+        return file.getFullPathName() + "@" + juce::String(sampleRate, 0) + "/" + juce::String(preprocessing.tailCutoffDb, 1)
+             + (preprocessing.minimumPhase ? "/min" : "");
+    }
+
+    void insert(const juce::String& key, Entry::Ptr entry)
+    {
+        {
+            const juce::ScopedLock sl(lock);
+            pending.erase(key);
+
+            if (entry != nullptr)
+            {
+                auto& slot = entries[key];
+                if (slot.entry != nullptr)
+                    memoryUsage -= slot.entry->getSizeInBytes();
+
+                slot.entry = entry;
+                slot.lastUsed = ++useCounter;
+                memoryUsage += entry->getSizeInBytes();
+                evictOverBudget(key);
+            }
+        }
+
+        entryFinished.signal();
+    }
+
+    // Never drops keep, so an IR larger than the whole budget still gets used once
+    void evictOverBudget(const juce::String& keep)
+    {
+        while (memoryUsage > memoryBudget)
+        {
+            auto oldest = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+                if (it->first != keep && (oldest == entries.end() || it->second.lastUsed < oldest->second.lastUsed))
+                    oldest = it;
+
+            if (oldest == entries.end())
+                return;
+
+            memoryUsage -= oldest->second.entry->getSizeInBytes();
+            entries.erase(oldest);
+        }
+    }
+
+    static juce::AudioBuffer<float> trimSilence(const juce::AudioBuffer<float>& buffer)
+    {
+        const float threshold = juce::Decibels::decibelsToGain(-80.0f);
+        const int numSamples = buffer.getNumSamples();
+        int start = numSamples;
+        int end = 0;
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            const float* data = buffer.getReadPointer(channel);
+            for (int i = 0; i < numSamples; ++i)
+                if (std::abs(data[i]) >= threshold) { start = juce::jmin(start, i); break; }
+            for (int i = numSamples; --i >= 0;)
+                if (std::abs(data[i]) >= threshold) { end = juce::jmax(end, i + 1); break; }
+        }
+
+        if (start >= end)
+        {
+            juce::AudioBuffer<float> silence(buffer.getNumChannels(), 1);
+            silence.clear();
+            return silence;
+        }
+
+        juce::AudioBuffer<float> trimmed(buffer.getNumChannels(), end - start);
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            trimmed.copyFrom(channel, 0, buffer, channel, start, end - start);
+        return trimmed;
+    }
+
+    // Index of the loudest sample over all channels
+    static int findPeak(const juce::AudioBuffer<float>& buffer)
+    {
+        int peak = 0;
+        float peakLevel = 0.0f;
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            const float* data = buffer.getReadPointer(channel);
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+            {
+                if (std::abs(data[i]) > peakLevel)
+                {
+                    peakLevel = std::abs(data[i]);
+                    peak = i;
+                }
+            }
+        }
+        return peak;
+    }
+
+    // Ends the IR where the energy left in every channel is cutoffDb below that channel's total
+    static void cutTail(juce::AudioBuffer<float>& buffer, float cutoffDb)
+    {
+        const double threshold = std::pow(10.0, cutoffDb / 10.0);
+        int length = 1;
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            const float* data = buffer.getReadPointer(channel);
+            double total = 0.0;
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                total += (double)data[i] * data[i];
+
+            // Walk back from the end until the tail holds more than threshold of the energy
+            double remaining = 0.0;
+            int end = buffer.getNumSamples();
+            while (end > 0 && remaining + (double)data[end - 1] * data[end - 1] <= threshold * total)
+            {
+                remaining += (double)data[end - 1] * data[end - 1];
+                --end;
+            }
+            length = juce::jmax(length, end);
+        }
+
+        if (length < buffer.getNumSamples())
+            buffer.setSize(buffer.getNumChannels(), length, true);
+    }
+
+    // Homomorphic minimum phase: fold the real cepstrum of each channel onto
+    // positive quefrencies and transform back. Zero-padded 8x so the cepstrum
+    // doesn't alias, which is why long IRs are refused rather than given a
+    // shorter FFT.
+    static void makeMinimumPhase(juce::AudioBuffer<float>& buffer)
+    {
+        const int length = buffer.getNumSamples();
+        if (length > maxMinimumPhaseLength)
+            return;
+
+        const int order = juce::jmax(4, (int)std::ceil(std::log2((double)length * 8.0)));
+        const int size = 1 << order;
+        juce::dsp::FFT fft(order);
+        std::vector<juce::dsp::Complex<float>> time((size_t)size), frequency((size_t)size);
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            float* data = buffer.getWritePointer(channel);
+            for (int i = 0; i < size; ++i)
+                time[(size_t)i] = { i < length ? data[i] : 0.0f, 0.0f };
+
+            fft.perform(time.data(), frequency.data(), false);
+            for (auto& bin : frequency)
+                bin = { std::log(juce::jmax(std::abs(bin), 1.0e-9f)), 0.0f };
+
+            fft.perform(frequency.data(), time.data(), true);
+            for (int i = 1; i < size / 2; ++i)
+            {
+                time[(size_t)i] *= 2.0f;
+                time[(size_t)(size - i)] = 0.0f;
+            }
+
+            fft.perform(time.data(), frequency.data(), false);
+            for (auto& bin : frequency)
+                bin = std::exp(bin);
+
+            fft.perform(frequency.data(), time.data(), true);
+            for (int i = 0; i < length; ++i)
+                data[i] = time[(size_t)i].real();
+        }
+    }
+
+    // Scales the loudest channel to an energy of 1/64, as juce::dsp::Convolution does
+    static void normalise(juce::AudioBuffer<float>& buffer)
+    {
+        float maxEnergy = 0.0f;
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            const float* data = buffer.getReadPointer(channel);
+            float energy = 0.0f;
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                energy += data[i] * data[i];
+            maxEnergy = juce::jmax(maxEnergy, energy);
+        }
+
+        if (maxEnergy > 0.0f)
+            buffer.applyGain(0.125f / std::sqrt(maxEnergy));
+    }
+
+    juce::ThreadPool pool;
+    juce::CriticalSection lock;
+    juce::WaitableEvent entryFinished;
+    std::map<juce::String, Slot> entries;
+    std::set<juce::String> pending;
+    size_t memoryBudget;
+    size_t memoryUsage = 0;
+    juce::uint64 useCounter = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(IRCache)
+};
@@ -1,5 +1,10 @@
 #pragma once
 #include <JuceHeader.h>
+#include "IRCache.h"
+#include "CrossfadingConvolution.h"
+#include "GainRamp.h"
+#include "RealtimeSafety.h"
+#include "StageProfiler.h"
 
 class IRProcessor
 {
@@ -13,147 +18,373 @@ public:
 
     void prepare(const juce::dsp::ProcessSpec& spec)
     {
+        currentSpec = spec;
+        if (workerPool != nullptr)
+            workerPool->prepare(spec.sampleRate, (int)spec.maximumBlockSize);
         convolutionCabinet.prepare(spec);
         convolutionReverb.prepare(spec);
 
         cabinetWetBuffer.setSize(spec.numChannels, spec.maximumBlockSize, false, true, false);
         reverbWetBuffer.setSize(spec.numChannels, spec.maximumBlockSize, false, true, false);
-        dryBuffer.setSize(spec.numChannels, spec.maximumBlockSize, false, true, false);
 
         dryDelayLine.prepare({ spec.sampleRate, spec.maximumBlockSize, spec.numChannels });
+        cabinetDryDelayLine.prepare({ spec.sampleRate, spec.maximumBlockSize, spec.numChannels });
+        cabinetDryDelayLine.setDelay((float)convolutionCabinet.getLatency());
         updateLatencyCompensation();
+        appliedDryDelay = -1;
+        cabinetWasBlending = false;
 
-        reverbGainSmoothed.reset(spec.sampleRate, 0.001f);
+        for (auto* ramp : { &reverbGainRamp, &cabinetDryRamp, &cabinetWetRamp })
+            ramp->reset(spec.sampleRate, rampSeconds);
+        jumpToTargets = true;
     }
 
     bool loadCabinetIR(const juce::File& file)
     {
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "IRProcessor::loadCabinetIR");
         if (!file.existsAsFile())
         {
             juce::Logger::writeToLog("Cabinet IR file not found: " + file.getFullPathName());
             return false;
         }
-        convolutionCabinet.loadImpulseResponse(
-            file,
-            juce::dsp::Convolution::Stereo::yes,
-            juce::dsp::Convolution::Trim::yes,
-            0,
-            juce::dsp::Convolution::Normalise::yes
-        );
+        if (!loadImpulseResponse(convolutionCabinet, file, cabinetPreprocessing))
+        {
+            juce::Logger::writeToLog("Cabinet IR file unreadable: " + file.getFullPathName());
+            return false;
+        }
         cabinetBypass = false;
         updateLatencyCompensation();
-        juce::Logger::writeToLog("Cabinet IR loaded and normalized: " + file.getFullPathName());
+        juce::Logger::writeToLog("Cabinet IR loaded and normalized: " + file.getFullPathName() + lastLoadReport);
         return true;
     }
 
     bool loadReverbIR(const juce::File& file)
     {
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "IRProcessor::loadReverbIR");
         if (!file.existsAsFile())
         {
             juce::Logger::writeToLog("Reverb IR file not found: " + file.getFullPathName());
             return false;
         }
-        convolutionReverb.loadImpulseResponse(
-            file,
-            juce::dsp::Convolution::Stereo::yes,
-            juce::dsp::Convolution::Trim::yes,
-            0,
-            juce::dsp::Convolution::Normalise::yes
-        );
+        if (!loadImpulseResponse(convolutionReverb, file, reverbPreprocessing))
+        {
+            juce::Logger::writeToLog("Reverb IR file unreadable: " + file.getFullPathName());
+            return false;
+        }
         reverbBypass = false;
         updateLatencyCompensation();
-        juce::Logger::writeToLog("Reverb IR loaded and normalized: " + file.getFullPathName());
+        juce::Logger::writeToLog("Reverb IR loaded and normalized: " + file.getFullPathName() + lastLoadReport);
         return true;
     }
 
+    // IRs are taken from this cache, already prepared for the device rate, instead
+    // of being read from disk on every load. The cache must outlive this processor.
+    void setCache(IRCache* newCache) { cache = newCache; }
+
+    // Times the cabinet and reverb in their own profiler slots
+    void setProfiler(StageProfiler* newProfiler) { profiler = newProfiler; }
+
+    // How IRs are shortened on load; takes effect from the next load. Preloads into
+    // the cache should use the same settings, or the loads will decode again.
+    void setCabinetPreprocessing(IRCache::Preprocessing newPreprocessing) { cabinetPreprocessing = newPreprocessing; }
+    void setReverbPreprocessing(IRCache::Preprocessing newPreprocessing) { reverbPreprocessing = newPreprocessing; }
+    IRCache::Preprocessing getCabinetPreprocessing() const { return cabinetPreprocessing; }
+    IRCache::Preprocessing getReverbPreprocessing() const { return reverbPreprocessing; }
+
+    // Runs each convolution's channels in parallel on the pool; nullptr keeps
+    // everything on the audio thread. Call before prepare. The pool must outlive this processor.
+    void setWorkerPool(RealtimeWorkerPool* newPool)
+    {
+        workerPool = newPool;
+        convolutionCabinet.setWorkerPool(newPool);
+        convolutionReverb.setWorkerPool(newPool);
+    }
+
     void resetCabinetIR()
     {
         cabinetBypass = true;
+        convolutionCabinet.clear();
         updateLatencyCompensation();
     }
 
     void resetReverbIR()
     {
         reverbBypass = true;
+        convolutionReverb.clear();
+        updateLatencyCompensation();
+    }
+
+    // IRs are built on a background thread and normally faded in by the audio
+    // thread. Offline renders call this after loading so the first real block
+    // already goes through the new IRs.
+    bool waitForPendingIRs(int timeoutMs)
+    {
+        if (!convolutionCabinet.finishPendingLoad(timeoutMs) || !convolutionReverb.finishPendingLoad(timeoutMs))
+            return false;
+
+        dryDelayLine.reset();
         updateLatencyCompensation();
+        jumpToTargets = true;
+        return true;
+    }
+
+    // Stereo path: the reverb is mixed into the dry signal and the cabinet runs on the sum
+    void process(juce::dsp::AudioBlock<float>& block)
+    {
+        applyControlChanges();
+        processReverb(block);
+        processCabinet(block);
+    }
+
+    // Mono engine path: only channel 0 carries signal on the way in. The cabinet
+    // runs on that channel alone unless its IR is stereo, and the block fans out
+    // to stereo in front of the reverb, the first stage that makes the sides differ.
+    void processFromMono(juce::dsp::AudioBlock<float>& block)
+    {
+        jassert(block.getNumChannels() == 2);
+
+        applyControlChanges();
+        const bool isCabinetStereo = convolutionCabinet.needsStereo();
+
+        if (!isCabinetStereo)
+        {
+            auto monoBlock = block.getSingleChannelBlock(0);
+            processCabinet(monoBlock);
+        }
+
+        juce::FloatVectorOperations::copy(block.getChannelPointer(1), block.getChannelPointer(0), (int)block.getNumSamples());
+
+        if (isCabinetStereo)
+            processCabinet(block);
+
+        processReverb(block);
+    }
+
+    // 0 is the dry signal, 1 the cabinet alone
+    void setCabinetMix(float newValue) { cabinetMixTarget = juce::jlimit(0.0f, 1.0f, newValue); }
+
+    // In dB, after the mix
+    void setCabinetGain(float newValue) { cabinetGainTarget = juce::jlimit(-12.0f, 12.0f, newValue); }
+
+    // On by default: each IR's first partition runs as a FIR, so neither convolution
+    // delays the dry path. Off saves that work for one partition of latency.
+    // Takes effect at the next prepare().
+    void setZeroLatency(bool shouldBeZeroLatency)
+    {
+        convolutionCabinet.setZeroLatency(shouldBeZeroLatency);
+        convolutionReverb.setZeroLatency(shouldBeZeroLatency);
+    }
+
+    void setReverbGain(float newValue) { reverbGainTarget = juce::jlimit(-12.0f, 12.0f, newValue); }
+
+    // Latency added by the stages in front of this one, e.g. the oversampled waveshapers.
+    // It delays dry and wet alike, so it is reported but never added to the dry delay line.
+    void setUpstreamLatency(int samples) { upstreamLatency = samples; }
+
+    int getLatencyInSamples() const { return upstreamLatency + dryPathLatency; }
+
+    // Audio thread. True if the last block paid for a cabinet or reverb crossfade.
+    bool isSwappingIRs() const
+    {
+        return convolutionCabinet.didCrossfadeInLastBlock() || convolutionReverb.didCrossfadeInLastBlock();
     }
 
-    void process(juce::dsp::AudioBlock<float>& block, bool useMix)
+private:
+    // Control side: works out the new dry delay, which the audio thread picks up on its next block
+    void updateLatencyCompensation()
     {
-        auto numSamples = block.getNumSamples();
-        auto numChannels = block.getNumChannels();
+        int cabinetLatency = cabinetBypass ? 0 : convolutionCabinet.getLatency();
+        int reverbLatency = reverbBypass ? 0 : convolutionReverb.getLatency();
 
-        jassert(cabinetWetBuffer.getNumSamples() >= numSamples);
-        jassert(reverbWetBuffer.getNumSamples() >= numSamples);
-        jassert(dryBuffer.getNumSamples() >= numSamples);
+        // The cabinet delays dry and wet alike on both paths, so only the reverb needs compensating
+        dryDelayTarget = reverbLatency;
+        dryPathLatency = cabinetLatency + reverbLatency;
+    }
 
-        float reverbGain = juce::Decibels::decibelsToGain(reverbGainSmoothed.getNextValue());
+    // Audio side: brings the delay line and gain ramps up to date with the controls
+    void applyControlChanges()
+    {
+        const float mix = cabinetMixTarget.load();
+        const float cabinetGain = juce::Decibels::decibelsToGain(cabinetGainTarget.load());
+        const float reverbGain = juce::Decibels::decibelsToGain(reverbGainTarget.load());
 
-        juce::dsp::AudioBlock<float> dryBlock(dryBuffer);
-        dryBlock.copyFrom(block);
-        juce::dsp::ProcessContextReplacing<float> dryContext(dryBlock);
-        dryDelayLine.process(dryContext);
+        // Settings made before the first block shouldn't ramp in from the defaults
+        if (jumpToTargets.exchange(false))
+        {
+            cabinetDryRamp.setCurrentAndTarget((1.0f - mix) * cabinetGain);
+            cabinetWetRamp.setCurrentAndTarget(mix * cabinetGain);
+            reverbGainRamp.setCurrentAndTarget(reverbGain);
+        }
+
+        cabinetDryRamp.setTarget((1.0f - mix) * cabinetGain);
+        cabinetWetRamp.setTarget(mix * cabinetGain);
+        reverbGainRamp.setTarget(reverbGain);
 
-        juce::dsp::AudioBlock<float> reverbWetBlock(reverbWetBuffer);
-        reverbWetBlock.copyFrom(block);
-        if (!reverbBypass)
+        const int delay = dryDelayTarget.load();
+        if (delay != appliedDryDelay)
         {
-            juce::dsp::ProcessContextReplacing<float> reverbContext(reverbWetBlock);
-            convolutionReverb.process(reverbContext);
+            // The line isn't fed while the delay is 0, so don't let it replay old samples
+            if (appliedDryDelay <= 0)
+                dryDelayLine.reset();
+            dryDelayLine.setDelay(static_cast<float>(delay));
+            appliedDryDelay = delay;
         }
+    }
 
-        for (size_t channel = 0; channel < numChannels; ++channel)
+    // block = delayed block + reverb * gain. With no reverb loaded this costs nothing.
+    void processReverb(juce::dsp::AudioBlock<float>& block)
+    {
+        const StageProfiler::PartScope profile(profiler, StageProfiler::reverb, StageProfiler::ir);
+        const auto numSamples = block.getNumSamples();
+        if (!convolutionReverb.isActive())
         {
-            auto* dryData = dryBlock.getChannelPointer(channel);
-            auto* revWetData = reverbWetBlock.getChannelPointer(channel);
+            reverbGainRamp.skip(numSamples);
+            return;
+        }
 
-            for (int sample = 0; sample < numSamples; ++sample)
-            {
-                revWetData[sample] = dryData[sample] + (reverbGain > 0.0f && !reverbBypass ? reverbGain * revWetData[sample] : 0.0f);
-            }
+        auto wetBlock = juce::dsp::AudioBlock<float>(reverbWetBuffer)
+                            .getSubsetChannelBlock(0, block.getNumChannels())
+                            .getSubBlock(0, numSamples);
+        wetBlock.copyFrom(block);
+        convolutionReverb.process(wetBlock);
+
+        if (appliedDryDelay > 0)
+        {
+            juce::dsp::ProcessContextReplacing<float> dryContext(block);
+            dryDelayLine.process(dryContext);
         }
 
-        juce::dsp::AudioBlock<float> cabinetWetBlock(cabinetWetBuffer);
-        cabinetWetBlock.copyFrom(reverbWetBlock);
-        if (!cabinetBypass)
+        ChannelPointers out(block), wet(wetBlock);
+        reverbGainRamp.addFrom(out.data, wet.data, out.numChannels, numSamples);
+    }
+
+    // block = block * (1 - mix) * gain + cabinet(block) * mix * gain. Fully wet
+    // runs the cabinet in place; only a blend needs a copy of the block.
+    void processCabinet(juce::dsp::AudioBlock<float>& block)
+    {
+        const StageProfiler::PartScope profile(profiler, StageProfiler::cabinet, StageProfiler::ir);
+        const auto numSamples = block.getNumSamples();
+        ChannelPointers out(block);
+
+        // With no IR the cabinet passes the block through, so only the gain is left
+        if (!convolutionCabinet.isActive())
         {
-            juce::dsp::ProcessContextReplacing<float> cabinetContext(cabinetWetBlock);
-            convolutionCabinet.process(cabinetContext);
+            if (!cabinetDryRamp.isSteadyAt(0.0f) || !cabinetWetRamp.isSteadyAt(1.0f))
+                cabinetDryRamp.mix(out.data, out.data, out.numChannels, numSamples, cabinetWetRamp);
+            cabinetWasBlending = false;
+            return;
         }
 
-        for (size_t channel = 0; channel < numChannels; ++channel)
+        if (cabinetDryRamp.isSteadyAt(0.0f))
         {
-            auto* cabWetData = cabinetWetBlock.getChannelPointer(channel);
-            auto* outData = block.getChannelPointer(channel);
+            convolutionCabinet.process(block);
+            if (!cabinetWetRamp.isSteadyAt(1.0f))
+                cabinetWetRamp.process(out.data, out.numChannels, numSamples);
+            cabinetWasBlending = false;
+            return;
+        }
 
-            for (int sample = 0; sample < numSamples; ++sample)
+        auto wetBlock = juce::dsp::AudioBlock<float>(cabinetWetBuffer)
+                            .getSubsetChannelBlock(0, block.getNumChannels())
+                            .getSubBlock(0, numSamples);
+        wetBlock.copyFrom(block);
+        convolutionCabinet.process(wetBlock);
+        delayCabinetDry(block);
+
+        ChannelPointers wet(wetBlock);
+        cabinetDryRamp.mix(out.data, wet.data, out.numChannels, numSamples, cabinetWetRamp);
+    }
+
+    // Only with zero latency off: lines the dry side of the blend up with the
+    // cabinet. The mono path may hand over a single channel, so this goes
+    // sample by sample rather than through the block interface.
+    void delayCabinetDry(juce::dsp::AudioBlock<float>& block)
+    {
+        if (convolutionCabinet.getLatency() == 0)
+            return;
+
+        if (!cabinetWasBlending)
+            cabinetDryDelayLine.reset();
+        cabinetWasBlending = true;
+
+        for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+        {
+            auto* data = block.getChannelPointer(channel);
+            for (size_t i = 0; i < block.getNumSamples(); ++i)
             {
-                outData[sample] = cabWetData[sample];
+                cabinetDryDelayLine.pushSample((int)channel, data[i]);
+                data[i] = cabinetDryDelayLine.popSample((int)channel);
             }
         }
     }
 
-    void setReverbGain(float newValue) { reverbGainSmoothed.setTargetValue(juce::jlimit(-12.0f, 12.0f, newValue)); }
+    // A block's channel pointers in the form GainRamp takes
+    struct ChannelPointers
+    {
+        explicit ChannelPointers(const juce::dsp::AudioBlock<float>& block)
+            : numChannels((int)juce::jmin(block.getNumChannels(), (size_t)2))
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                data[channel] = block.getChannelPointer((size_t)channel);
+        }
+
+        float* data[2] = {};
+        int numChannels;
+    };
 
-private:
-    void updateLatencyCompensation()
+    // Hands the IR to the convolution's loader, which crossfades to it once it is
+    // built. Returns false if the cache couldn't read the file.
+    bool loadImpulseResponse(CrossfadingConvolution& convolution, const juce::File& file, IRCache::Preprocessing preprocessing)
     {
-        int totalLatency = (cabinetBypass ? 0 : convolutionCabinet.getLatency()) +
-            (reverbBypass ? 0 : convolutionReverb.getLatency());
-        dryDelayLine.setDelay(static_cast<float>(totalLatency));
+        lastLoadReport.clear();
+        if (cache == nullptr)
+        {
+            convolution.load(file, preprocessing);
+            return true;
+        }
+
+        auto entry = cache->get(file, currentSpec.sampleRate, preprocessing);
+        if (entry == nullptr)
+            return false;
+
+        lastLoadReport << ", " << entry->buffer.getNumSamples() << " taps (" << entry->getTapsSaved() << " saved), peak at "
+                       << entry->peakDelay << " samples (" << entry->getLatencySaved() << " earlier)";
+        convolution.load(juce::AudioBuffer<float>(entry->buffer), entry->sampleRate);
+        return true;
     }
 
-    juce::dsp::Convolution convolutionCabinet;
-    juce::dsp::Convolution convolutionReverb;
+    juce::dsp::ProcessSpec currentSpec{ 44100.0, 512, 2 };
+    IRCache* cache = nullptr;
+    StageProfiler* profiler = nullptr;
+    IRCache::Preprocessing cabinetPreprocessing;
+    IRCache::Preprocessing reverbPreprocessing;
+    juce::String lastLoadReport;
+    RealtimeWorkerPool* workerPool = nullptr;
+    // The cabinet fades from one IR to the next; the reverb fades its input over
+    // and lets the old room ring out
+    CrossfadingConvolution convolutionCabinet{ CrossfadingConvolution::Fade::output, true, 0.05 };
+    CrossfadingConvolution convolutionReverb{ CrossfadingConvolution::Fade::input, false, 0.05 };
     juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::Linear> dryDelayLine;
+    juce::dsp::DelayLine<float, juce::dsp::DelayLineInterpolationTypes::None> cabinetDryDelayLine{ 8192 };
     juce::AudioBuffer<float> cabinetWetBuffer;
     juce::AudioBuffer<float> reverbWetBuffer;
-    juce::AudioBuffer<float> dryBuffer;
-    juce::SmoothedValue<float> cabinetMixSmoothed{ 1.0f };
-    juce::SmoothedValue<float> cabinetGainSmoothed{ 0.0f };
-    juce::SmoothedValue<float> reverbGainSmoothed{ 0.0f };
-    bool cabinetBypass;
-    bool reverbBypass;
+
+    // The cabinet mix and gain fold into one gain for each side of the blend
+    static constexpr double rampSeconds = 0.02;
+    GainRamp cabinetDryRamp{ GainRamp::Shape::linear };
+    GainRamp cabinetWetRamp{ GainRamp::Shape::linear };
+    GainRamp reverbGainRamp;
+    std::atomic<float> cabinetMixTarget{ 1.0f };
+    std::atomic<float> cabinetGainTarget{ 0.0f };
+    std::atomic<float> reverbGainTarget{ 0.0f };
+    std::atomic<bool> jumpToTargets{ true };
+    std::atomic<bool> cabinetBypass;
+    std::atomic<bool> reverbBypass;
+    bool cabinetWasBlending = false;
+    std::atomic<int> dryDelayTarget{ 0 };
+    int appliedDryDelay = -1;
+    std::atomic<int> dryPathLatency{ 0 };
+    std::atomic<int> upstreamLatency{ 0 };
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(IRProcessor)
 };
\ No newline at end of file
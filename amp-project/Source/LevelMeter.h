@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include "SIMDTarget.h"
+
+// Peak and energy of one block
+struct LevelStats
+{
+    float peak = 0.0f;
+    double sumOfSquares = 0.0;
+    std::int64_t numSamples = 0;
+};
+
+// Gathers LevelStats from inside a loop that already has the samples in
+// registers, so metering never needs a pass of its own. The vector lanes are
+// only folded together by finish().
+class LevelAccumulator
+{
+public:
+    explicit LevelAccumulator(LevelStats& target) : stats(target) {}
+
+   #if AMP_SIMD_FLOAT4
+    void add(Float4::Type samples)
+    {
+        peaks = Float4::max(peaks, Float4::abs(samples));
+        squares = Float4::add(squares, Float4::mul(samples, samples));
+    }
+   #endif
+
+    void add(float sample)
+    {
+        peak = std::max(peak, std::abs(sample));
+        sumOfSquares += sample * sample;
+    }
+
+    void finish(size_t numSamples)
+    {
+       #if AMP_SIMD_FLOAT4
+        float lanes[4];
+        Float4::store(lanes, peaks);
+        peak = std::max({ peak, lanes[0], lanes[1], lanes[2], lanes[3] });
+        Float4::store(lanes, squares);
+        sumOfSquares += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        peaks = squares = Float4::broadcast(0.0f);
+       #endif
+
+        stats.peak = std::max(stats.peak, peak);
+        stats.sumOfSquares += sumOfSquares;
+        stats.numSamples += (std::int64_t)numSamples;
+        peak = 0.0f;
+        sumOfSquares = 0.0f;
+    }
+
+private:
+    LevelStats& stats;
+   #if AMP_SIMD_FLOAT4
+    Float4::Type peaks = Float4::broadcast(0.0f);
+    Float4::Type squares = Float4::broadcast(0.0f);
+   #endif
+    float peak = 0.0f;
+    float sumOfSquares = 0.0f;
+};
+
+// Stands in for LevelAccumulator in the loops that aren't metered; compiles to nothing
+struct NoLevels
+{
+   #if AMP_SIMD_FLOAT4
+    void add(Float4::Type) {}
+   #endif
+    void add(float) {}
+    void finish(size_t) {}
+};
+
+// Hands block levels from the audio thread to one reader, usually a meter
+// component polling at display rate. Energy goes out as running totals under a
+// sequence lock, so the reader gets the RMS over exactly the samples since its
+// last read and never a sum from one block with a count from another. The peak
+// is a max that the reader swaps back to zero. Nothing on either side blocks.
+class LevelMeter
+{
+public:
+    struct Reading
+    {
+        float rms = 0.0f;
+        float peak = 0.0f;
+        int overs = 0;      // Blocks that went past full scale since the last resetOvers()
+    };
+
+    // Audio thread, once per block
+    void publish(const LevelStats& stats)
+    {
+        writerSquares += stats.sumOfSquares;
+        writerSamples += stats.numSamples;
+
+        const auto count = sequence.load(std::memory_order_relaxed);
+        sequence.store(count + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        totalSquares.store(writerSquares, std::memory_order_relaxed);
+        totalSamples.store(writerSamples, std::memory_order_relaxed);
+        sequence.store(count + 2, std::memory_order_release);
+
+        float previous = peak.load(std::memory_order_relaxed);
+        while (stats.peak > previous && !peak.compare_exchange_weak(previous, stats.peak, std::memory_order_relaxed))
+        {
+        }
+
+        if (stats.peak > 1.0f)
+            overs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The reading thread. RMS and peak over everything published since the previous call.
+    Reading read()
+    {
+        double squares;
+        std::int64_t samples;
+        for (;;)
+        {
+            const auto before = sequence.load(std::memory_order_acquire);
+            squares = totalSquares.load(std::memory_order_relaxed);
+            samples = totalSamples.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((before & 1) == 0 && before == sequence.load(std::memory_order_relaxed))
+                break;
+        }
+
+        Reading reading;
+        const auto newSamples = samples - readerSamples;
+        if (newSamples > 0)
+            reading.rms = (float)std::sqrt(std::max(0.0, squares - readerSquares) / (double)newSamples);
+
+        reading.peak = peak.exchange(0.0f, std::memory_order_relaxed);
+        reading.overs = overs.load(std::memory_order_relaxed);
+
+        readerSquares = squares;
+        readerSamples = samples;
+        return reading;
+    }
+
+    void resetOvers() { overs.store(0, std::memory_order_relaxed); }
+
+private:
+    // Audio thread
+    double writerSquares = 0.0;
+    std::int64_t writerSamples = 0;
+
+    std::atomic<std::uint32_t> sequence{ 0 };
+    std::atomic<double> totalSquares{ 0.0 };
+    std::atomic<std::int64_t> totalSamples{ 0 };
+    std::atomic<float> peak{ 0.0f };
+    std::atomic<int> overs{ 0 };
+
+    // Reader
+    double readerSquares = 0.0;
+    std::int64_t readerSamples = 0;
+};
@@ -0,0 +1,105 @@
+#pragma once
+#include <JuceHeader.h>
+#include "LevelMeter.h"
+
+// A horizontal meter pulling from a LevelMeter once per display refresh: an
+// RMS bar, a tick at the latest peak, a held peak that falls after a moment,
+// and a clip light counting overs. Clicking it clears the count.
+class LevelMeterComponent : public juce::Component
+{
+public:
+    LevelMeterComponent(LevelMeter& source, juce::Colour barColour)
+        : meter(source), colour(barColour),
+          vBlank(this, [this]() { update(); })
+    {
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        auto bounds = getLocalBounds().toFloat();
+        auto clipLight = bounds.removeFromRight(bounds.getHeight() * 1.6f).reduced(2.0f);
+
+        g.setColour(juce::Colours::black.withAlpha(0.7f));
+        g.fillRect(bounds);
+
+        auto bar = bounds.reduced(2.0f);
+        g.setColour(colour);
+        g.fillRect(bar.withWidth(bar.getWidth() * toProportion(rms)));
+
+        g.setColour(colour.brighter(0.6f));
+        const float peakX = bar.getX() + bar.getWidth() * toProportion(peak);
+        g.drawLine(peakX, bar.getY(), peakX, bar.getBottom(), 1.0f);
+
+        g.setColour(juce::Colours::white);
+        const float holdX = bar.getX() + bar.getWidth() * toProportion(heldPeak);
+        g.drawLine(holdX, bar.getY(), holdX, bar.getBottom(), 2.0f);
+
+        g.setColour(overs > 0 ? juce::Colours::red : juce::Colours::darkred.withAlpha(0.5f));
+        g.fillRect(clipLight);
+        if (overs > 0)
+        {
+            g.setColour(juce::Colours::white);
+            g.setFont(11.0f);
+            g.drawText(juce::String(juce::jmin(overs, 999)), clipLight, juce::Justification::centred);
+        }
+    }
+
+    void mouseDown(const juce::MouseEvent&) override
+    {
+        meter.resetOvers();
+        overs = 0;
+        repaint();
+    }
+
+private:
+    static constexpr float floorDb = -60.0f;
+    static constexpr double holdSeconds = 1.5;
+    static constexpr float fallDbPerSecond = 20.0f;
+
+    static float toProportion(float level)
+    {
+        return juce::jmap(juce::jlimit(floorDb, 0.0f, juce::Decibels::gainToDecibels(level, floorDb)), floorDb, 0.0f, 0.0f, 1.0f);
+    }
+
+    void update()
+    {
+        const auto reading = meter.read();
+        const double now = juce::Time::getMillisecondCounterHiRes() * 0.001;
+        const double elapsed = lastUpdate > 0.0 ? now - lastUpdate : 0.0;
+        lastUpdate = now;
+
+        const float previousHold = heldPeak;
+        if (reading.peak >= heldPeak)
+        {
+            heldPeak = reading.peak;
+            holdUntil = now + holdSeconds;
+        }
+        else if (now > holdUntil)
+        {
+            heldPeak *= juce::Decibels::decibelsToGain(-fallDbPerSecond * (float)elapsed);
+            if (heldPeak < juce::Decibels::decibelsToGain(floorDb))
+                heldPeak = 0.0f;
+        }
+
+        // Silence stays silent without repainting
+        if (reading.rms == rms && reading.peak == peak && reading.overs == overs && heldPeak == previousHold)
+            return;
+
+        rms = reading.rms;
+        peak = reading.peak;
+        overs = reading.overs;
+        repaint();
+    }
+
+    LevelMeter& meter;
+    juce::Colour colour;
+    float rms = 0.0f;
+    float peak = 0.0f;
+    float heldPeak = 0.0f;
+    int overs = 0;
+    double holdUntil = 0.0;
+    double lastUpdate = 0.0;
+    juce::VBlankAttachment vBlank;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LevelMeterComponent)
+};
@@ -8,6 +8,10 @@
 
 #include <JuceHeader.h>
 #include "MainComponent.h"
+#include "OfflineRenderer.h"
+#include "RealtimeSafety.h"
+#include "StageBenchmark.h"
+#include "StressHarness.h"
 
 //==============================================================================
 class ampprojectApplication  : public juce::JUCEApplication
@@ -24,6 +28,18 @@ public:
     void initialise (const juce::String& commandLine) override
     {
         // This method is where you should put your application's initialisation code..
+        RealtimeSafety::install();
+
+        // Command line tools run headless and quit without ever opening the main window
+        juce::ArgumentList args (getApplicationName(), getCommandLineParameterArray());
+        registerCommandLineTools();
+
+        if (args.size() > 0 && commandLineTools.findCommand (args, true) != nullptr)
+        {
+            setApplicationReturnValue (commandLineTools.findAndRunCommand (args, true));
+            quit();
+            return;
+        }
 
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
@@ -33,6 +49,9 @@ public:
         // Add your application's shutdown code here..
 
         mainWindow = nullptr; // (deletes our window)
+
+        if (RealtimeSafety::getNumViolations() > 0)
+            DBG (RealtimeSafety::getReport());
     }
 
     //==============================================================================
@@ -98,6 +117,15 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    juce::ConsoleApplication commandLineTools;
+
+    void registerCommandLineTools()
+    {
+        commandLineTools.addHelpCommand ("--help|-h", "Usage:", false);
+        commandLineTools.addCommand (OfflineRenderer::getCommand());
+        commandLineTools.addCommand (StageBenchmark::getCommand());
+        commandLineTools.addCommand (StressHarness::getCommand());
+    }
 };
 
 //==============================================================================
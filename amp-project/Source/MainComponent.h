@@ -1,14 +1,17 @@
 #pragma once
 #include <JuceHeader.h>
 #include "IOMenuWindow.h"
-#include "ToneStack.h"
-#include "WaveshaperProcessor.h"
-#include "IRProcessor.h"
+#include "DiagnosticsWindow.h"
+#include "AmpEngine.h"
 #include "Presets.h"
+#include "PitchDetector.h"
 #include "TunerComponent.h"
+#include "LevelMeterComponent.h"
+#include "RealtimeSafety.h"
 #include <vector>
 #include "CustomKnobLook.h"
 #include "Profiles.h"
+#include "IRCache.h"
 
 class MainComponent : public juce::AudioAppComponent
 {
@@ -18,10 +21,12 @@ public:
         lowQSlider, midGainSlider,
         highGainSlider, reverbGainSlider,
         cabinetIrSelector, reverbIrSelector,
-        waveshaper, eq, irProcessor,
+        oversamplingSelector, antialiasingSelector,
+        engine,
         cabinetIrFiles, reverbIrFiles)
     {
         setSize(1280, 720);
+        irProcessor.setCache(&irCache);
 
         // Audio setup
         if (juce::RuntimePermissions::isRequired(juce::RuntimePermissions::recordAudio)
@@ -42,10 +47,8 @@ public:
         // UI Setup
      
         addAndMakeVisible(presetSelector);
-        presetSelector.addItem("Marshall", 1);
-        presetSelector.addItem("Vox", 2);
-        presetSelector.addItem("Fender", 3);
-        presetSelector.addItem("Tuner", 4); 
+        for (int i = 0; i < 3; ++i)
+            presetSelector.addItem(presetNames[i], i + 1);
 
         presetSelector.onChange = [this]() {
             int selectedIndex = presetSelector.getSelectedId() - 1;
@@ -92,17 +95,46 @@ public:
             }
             };
         
+        addAndMakeVisible(oversamplingSelector);
+        oversamplingSelector.addItem("No OS", 1);
+        oversamplingSelector.addItem("2x OS", 2);
+        oversamplingSelector.addItem("4x OS", 4);
+        oversamplingSelector.addItem("8x OS", 8);
+        oversamplingSelector.setSelectedId(1);
+        oversamplingSelector.onChange = [this]() {
+            engine.setOversamplingFactor(juce::jmax(1, oversamplingSelector.getSelectedId()));
+            };
+        
+        addAndMakeVisible(antialiasingSelector);
+        antialiasingSelector.addItem("No ADAA", 1);
+        antialiasingSelector.addItem("ADAA 1", 2);
+        antialiasingSelector.addItem("ADAA 2", 3);
+        antialiasingSelector.setSelectedId(1);
+        antialiasingSelector.onChange = [this]() {
+            engine.setAntiderivativeOrder(juce::jmax(0, antialiasingSelector.getSelectedId() - 1));
+            };
+
         addAndMakeVisible(tunerDisplay);
         tunerDisplay.setVisible(false);
-        smoothedPitch.reset(0.05);   
+
+        // The tuner is an overlay; the amp keeps playing underneath unless muted
+        addAndMakeVisible(tunerButton);
+        tunerButton.setClickingTogglesState(true);
+        tunerButton.onClick = [this]() { showTuner(tunerButton.getToggleState()); };
+
+        addChildComponent(muteOnTuneButton);
+        muteOnTuneButton.onClick = [this]() { muteOnTune = muteOnTuneButton.getToggleState(); };
 
         addAndMakeVisible(openMenu);
         openMenu.onClick = [this]() { openIOMenuWindow(); };
 
+        addAndMakeVisible(diagnosticsButton);
+        diagnosticsButton.onClick = [this]() { openDiagnosticsWindow(); };
+
         addAndMakeVisible(inputGainSlider);
         inputGainSlider.setSliderStyle(juce::Slider::Rotary);
         inputGainSlider.setTextBoxStyle(juce::Slider::TextBoxBelow, false, 80, 20);
-        inputGainSlider.onValueChange = [this]() { gain = inputGainSlider.getValue(); };
+        inputGainSlider.onValueChange = [this]() { engine.setInputGain((float)inputGainSlider.getValue()); };
         addAndMakeVisible(inputGainLabel);
         inputGainLabel.setText("Input Gain", juce::dontSendNotification);
         styleLabel(inputGainLabel);
@@ -110,7 +142,7 @@ public:
         addAndMakeVisible(outputGainSlider);
         outputGainSlider.setSliderStyle(juce::Slider::Rotary);
         outputGainSlider.setTextBoxStyle(juce::Slider::TextBoxBelow, false, 80, 20);
-        outputGainSlider.onValueChange = [this]() { outputGain = outputGainSlider.getValue(); };
+        outputGainSlider.onValueChange = [this]() { engine.setOutputGain((float)outputGainSlider.getValue()); };
         addAndMakeVisible(outputGainLabel);
         outputGainLabel.setText("Output Gain", juce::dontSendNotification);
         styleLabel(outputGainLabel);
@@ -150,15 +182,7 @@ public:
         styleLabel(reverbGainLabel);
 
         addAndMakeVisible(inputMeter);
-        inputMeter.setPercentageDisplay(false);
-        inputMeter.setColour(juce::ProgressBar::foregroundColourId, juce::Colours::limegreen);
-
         addAndMakeVisible(outputMeter);
-        outputMeter.setPercentageDisplay(false);
-        outputMeter.setColour(juce::ProgressBar::foregroundColourId, juce::Colours::orange);
-
-        smoothedInput.reset(0.1);
-        smoothedOutput.reset(0.1);
 
         addAndMakeVisible(inputMeterLabel);
         inputMeterLabel.setText("Input Level", juce::dontSendNotification);
@@ -230,130 +254,48 @@ public:
 
     void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
     {
-        tunerWritePosition = 0;
-        currentSampleRate = sampleRate;
-        tunerInputBuffer.setSize(1, 4096);
-        tunerInputBuffer.clear();
+        pitchDetector.prepare(sampleRate);
+
         juce::dsp::ProcessSpec spec;
         spec.sampleRate = sampleRate;
         spec.maximumBlockSize = samplesPerBlockExpected;
         spec.numChannels = 2;
 
-        waveshaper.prepare(spec);
-        eq.prepare(spec);
-        irProcessor.prepare(spec);
+        engine.prepare(spec);
+
+        // Decode every IR for the new rate in the background, so picking one never waits on the disk
+        juce::Component::SafePointer<MainComponent> safeThis(this);
+        juce::MessageManager::callAsync([safeThis, sampleRate]()
+        {
+            if (safeThis != nullptr)
+            {
+                safeThis->irCache.preload(safeThis->cabinetIrFiles, sampleRate, safeThis->irProcessor.getCabinetPreprocessing());
+                safeThis->irCache.preload(safeThis->reverbIrFiles, sampleRate, safeThis->irProcessor.getReverbPreprocessing());
+            }
+        });
     }
 
     void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
     {
+        const RealtimeSafety::ScopedAudioThread realtime;
+        const StageProfiler::CallbackScope profile(engine.getProfiler(), bufferToFill.numSamples);
         juce::dsp::AudioBlock<float> block(*bufferToFill.buffer);
-        if (presetSelector.getSelectedId() == 4)
+        if (tunerMode.load())
         {
+            // Detection runs on the pitch detector's thread; the tuner display polls it
             auto* inputBuffer = bufferToFill.buffer;
-            const float* in = inputBuffer->getReadPointer(0);
-            int newSamples = inputBuffer->getNumSamples();
-        
-            if (tunerInputBuffer.getNumSamples() < 4096)
-                tunerInputBuffer.setSize(1, 4096);
-        
-            int bufferSize = tunerInputBuffer.getNumSamples();
-            int remainingSpace = bufferSize - tunerWritePosition;
-            int copyAmount = juce::jmin(newSamples, remainingSpace);
-
-            tunerInputBuffer.copyFrom(0, tunerWritePosition, in, copyAmount);
-            tunerWritePosition += copyAmount;
+            pitchDetector.push(inputBuffer->getReadPointer(0, bufferToFill.startSample), bufferToFill.numSamples);
 
-            if (tunerWritePosition >= bufferSize)
-                tunerWritePosition = 0;
-        
-            float inputRMS = inputBuffer->getRMSLevel(0, 0, newSamples);
-            if (inputRMS > 0.01f)
+            if (muteOnTune.load())
             {
-                float workingData[2048];
-                int start = (tunerWritePosition >= 2048) ? (tunerWritePosition - 2048) : (4096 + tunerWritePosition - 2048);
-                for (int i = 0; i < 2048; ++i)
-                {
-                    workingData[i] = tunerInputBuffer.getSample(0, (start + i) % 4096);
-                }
-                int detectSize = 2048;
-        
-                float threshold = juce::jlimit(0.02f, 0.2f, inputRMS * 0.6f);
-                centerClip(workingData, detectSize, threshold);
-        
-                juce::IIRFilter lowpass;
-                lowpass.setCoefficients(juce::IIRCoefficients::makeLowPass(currentSampleRate, 600.0f));
-                lowpass.processSamples(workingData, detectSize);
-        
-                float pitch = detectPitchYIN(workingData, detectSize, currentSampleRate);
-
-                if (pitch > 40.0f && pitch < 1200.0f)
-                {
-                    if (std::abs(pitch - lastRawPitch) < pitchTolerance)
-                    {
-                        ++stableFrameCount;
-                    }
-                    else
-                    {
-                        stableFrameCount = 0;
-                    }
-
-                    lastRawPitch = pitch;
-
-                    if (stableFrameCount >= pitchLockThreshold)
-                    {
-                        lastStablePitch = pitch;
-                    }
-                }
-                else
-                {
-                    stableFrameCount = 0;
-                }
-
-                smoothedPitch.setTargetValue(lastStablePitch);
-                tunerDisplay.setFrequency(smoothedPitch.getNextValue());
-
-            }
-            else
-            {
-                tunerDisplay.setFrequency(0.0f);
+                bufferToFill.clearActiveBufferRegion();
+                return;
             }
-        
-            inputBuffer->clear();
-            return;
         }
         
-        auto* buffer = bufferToFill.buffer;
-        float inputRMS = buffer->getRMSLevel(0, bufferToFill.startSample, bufferToFill.numSamples);
-        smoothedInput.setTargetValue(inputRMS);
-        inputLevel = smoothedInput.getNextValue();
-
-        for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
-            juce::FloatVectorOperations::multiply(block.getChannelPointer(channel),
-                gain,
-                bufferToFill.numSamples);
-        }
-
-        waveshaper.processPreEQ(block);
-        eq.process(block);
-        waveshaper.processPostEQ(block);
-        irProcessor.process(block, true);
-
-        for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
-            juce::FloatVectorOperations::multiply(block.getChannelPointer(channel),
-                outputGain,
-                bufferToFill.numSamples);
-        }
-
-        float outputRMS = buffer->getRMSLevel(0, bufferToFill.startSample, bufferToFill.numSamples);
-        smoothedOutput.setTargetValue(outputRMS);
-        outputLevel = smoothedOutput.getNextValue();    
-
-        for (size_t channel = 0; channel < block.getNumChannels(); ++channel) {
-            auto* channelData = block.getChannelPointer(channel);
-            for (int sample = 0; sample < bufferToFill.numSamples; ++sample) {
-                channelData[sample] = juce::jlimit(-1.0f, 1.0f, channelData[sample]);
-            }
-        }
+        // The meters are fed from inside the input gain and output clamp passes
+        engine.process(block);
+        engine.clampOutput(block);
     }
 
     void releaseResources() override {}
@@ -429,11 +371,15 @@ public:
     
         // TOP MENU
         int menuY = 10;
-        cabinetIrSelector.setBounds(445, menuY, 300, 30);
-        reverbIrSelector.setBounds(755, menuY, 300, 30);
+        cabinetIrSelector.setBounds(445, menuY, 280, 30);
+        reverbIrSelector.setBounds(730, menuY, 280, 30);
+        antialiasingSelector.setBounds(1015, menuY, 76, 30);
+        oversamplingSelector.setBounds(1094, menuY, 72, 30);
         openMenu.setBounds(1170, menuY, 100, 30);
+        diagnosticsButton.setBounds(1170, menuY + 35, 100, 30);
         presetSelector.setBounds(10, menuY, 200, 30);
         profilesButton.setBounds(275, menuY, 100, 30);
+        tunerButton.setBounds(215, menuY, 55, 30);
     
         // METERS (bottom)
         inputMeter.setBounds(420, 690, 200, 20);
@@ -443,6 +389,7 @@ public:
     
         // Tuner
         tunerDisplay.setBounds(440, 200, 420, 280);
+        muteOnTuneButton.setBounds(440, 495, 200, 24);
     }
     
     
@@ -452,18 +399,9 @@ private:
 
     CustomKnobLook knobLook;
 
-    int tunerWritePosition = 0;
-    float lastStablePitch = 0.0f;
-    float lastRawPitch = 0.0f;
-    int stableFrameCount = 0;
-    const int pitchLockThreshold = 5;
-    const float pitchTolerance = 3.0f;
+    std::atomic<bool> tunerMode{ false };
+    std::atomic<bool> muteOnTune{ false };
     
-    double inputLevel = 0.0f;
-    double outputLevel = 0.0f;
-    juce::ProgressBar inputMeter { inputLevel };
-    juce::ProgressBar outputMeter { outputLevel };
-    juce::SmoothedValue<float> smoothedInput { 0.0f }, smoothedOutput { 0.0f };
     juce::Label inputMeterLabel;
     juce::Label outputMeterLabel;
     juce::ComboBox presetSelector;
@@ -471,21 +409,29 @@ private:
 
     juce::TextButton openMenu{ "I/O Menu", "Open I/O Menu" };
     juce::Component::SafePointer<IOMenuWindow> ioMenuWindow;
-
-    WaveshaperProcessor waveshaper;
-    ToneStack eq;
-    IRProcessor irProcessor;
-
-    TunerComponent tunerDisplay;
-    juce::SmoothedValue<float> smoothedPitch;
-    double currentSampleRate = 44100.0;
-    juce::AudioBuffer<float> tunerInputBuffer;
+    juce::TextButton diagnosticsButton{ "Diagnostics", "Show where the audio callback spends its time" };
+    juce::Component::SafePointer<DiagnosticsWindow> diagnosticsWindow;
+
+    IRCache irCache;
+    AmpEngine engine;
+    WaveshaperProcessor& waveshaper = engine.getWaveshaper();
+    ToneStack& eq = engine.getToneStack();
+    IRProcessor& irProcessor = engine.getIRProcessor();
+    LevelMeterComponent inputMeter{ engine.getInputMeter(), juce::Colours::limegreen };
+    LevelMeterComponent outputMeter{ engine.getOutputMeter(), juce::Colours::orange };
+
+    PitchDetector pitchDetector;
+    TunerComponent tunerDisplay{ pitchDetector };
+    juce::TextButton tunerButton{ "Tuner", "Show the tuner" };
+    juce::ToggleButton muteOnTuneButton{ "Mute while tuning" };
     juce::TextButton profilesButton;
 
     juce::ComboBox cabinetIrSelector;
     juce::Array<juce::File> cabinetIrFiles;
     juce::ComboBox reverbIrSelector;
     juce::Array<juce::File> reverbIrFiles;
+    juce::ComboBox oversamplingSelector;
+    juce::ComboBox antialiasingSelector;
 
     juce::Slider inputGainSlider;
     juce::Label inputGainLabel;
@@ -500,9 +446,6 @@ private:
     juce::Slider reverbGainSlider;
     juce::Label reverbGainLabel;
 
-    float gain = 1.0f;
-    float outputGain = 1.0f;
-
     void styleLabel(juce::Label& label)
     {
         label.setJustificationType(juce::Justification::centred);
@@ -515,63 +458,6 @@ private:
         label.setBorderSize(juce::BorderSize<int>(4)); // top/bottom/left/right padding
     }
 
-    float detectPitchYIN(const float* buffer, int numSamples, float sampleRate)
-    {
-        const int maxLag = numSamples / 2;
-        std::vector<float> difference(maxLag);
-        std::vector<float> cumulativeDifference(maxLag);
-
-        for (int tau = 1; tau < maxLag; ++tau)
-        {
-            float sum = 0.0f;
-            for (int i = 0; i < maxLag; ++i)
-            {
-                float diff = buffer[i] - buffer[i + tau];
-                sum += diff * diff;
-            }
-            difference[tau] = sum;
-        }
-
-        cumulativeDifference[0] = 1.0f;
-        float runningSum = 0.0f;
-        for (int tau = 1; tau < maxLag; ++tau)
-        {
-            runningSum += difference[tau];
-            cumulativeDifference[tau] = difference[tau] * tau / runningSum;
-        }
-
-        const float threshold = 0.1f;
-        int bestTau = -1;
-        for (int tau = 2; tau < maxLag; ++tau)
-        {
-            if (cumulativeDifference[tau] < threshold)
-            {
-                while (tau + 1 < maxLag && cumulativeDifference[tau + 1] < cumulativeDifference[tau])
-                ++tau;
-                bestTau = tau;
-                break;
-            }
-        }
-
-        if (bestTau != -1)
-            return sampleRate / bestTau;
-
-        return 0.0f;
-    }
-
-
-    void centerClip(float* buffer, int numSamples, float threshold = 0.1f)
-    {
-        for (int i = 0; i < numSamples; ++i)
-        {
-            if (buffer[i] > threshold)
-                buffer[i] -= threshold;
-            else if (buffer[i] < -threshold)
-                buffer[i] += threshold;
-            else
-                buffer[i] = 0.0f;
-        }
-    }
     ProfileManager profileManager;
 
 
@@ -585,6 +471,16 @@ private:
         }
     }
 
+    void openDiagnosticsWindow()
+    {
+        if (diagnosticsWindow == nullptr)
+        {
+            auto* window = new DiagnosticsWindow("Diagnostics", engine.getProfiler(), deviceManager);
+            diagnosticsWindow = window;
+            window->setVisible(true);
+        }
+    }
+
     void loadCabinetIRsFromFolder()
     {
         juce::File irFolder("C:/Users/kylep/source/repos/amp-project/amp-project/Source/IRs/Cabinet");
@@ -613,50 +509,21 @@ private:
             reverbIrSelector.addItem(reverbIrFiles[i].getFileNameWithoutExtension(), i + 2);
     }
 
-    void setPreset(int index)
+    void showTuner(bool shouldShow)
     {
-        if (index == 3)
+        tunerMode = shouldShow;
+        tunerDisplay.setVisible(shouldShow);
+        muteOnTuneButton.setVisible(shouldShow);
+        if (shouldShow)
         {
-            tunerDisplay.setVisible(true);
-            repaint();
-
-            gain = 0.0f;
-            outputGain = 0.0f;
-
-            inputGainSlider.setVisible(false);
-            outputGainSlider.setVisible(false);
-            lowQSlider.setVisible(false);
-            midGainSlider.setVisible(false);
-            highGainSlider.setVisible(false);
-            reverbGainSlider.setVisible(false);
-
-            inputGainLabel.setVisible(false);
-            outputGainLabel.setVisible(false);
-            lowQLabel.setVisible(false);
-            midGainLabel.setVisible(false);
-            highGainLabel.setVisible(false);
-            reverbGainLabel.setVisible(false);
-
-            return;
-        }
-        else
-        {
-            tunerDisplay.setVisible(false);
-
-            inputGainSlider.setVisible(true);
-            outputGainSlider.setVisible(true);
-            lowQSlider.setVisible(true);
-            midGainSlider.setVisible(true);
-            highGainSlider.setVisible(true);
-            reverbGainSlider.setVisible(true);
-        
-            inputGainLabel.setVisible(true);
-            outputGainLabel.setVisible(true);
-            lowQLabel.setVisible(true);
-            midGainLabel.setVisible(true);
-            highGainLabel.setVisible(true);
-            reverbGainLabel.setVisible(true);
+            tunerDisplay.toFront(false);
+            muteOnTuneButton.toFront(false);
         }
+        repaint();
+    }
+
+    void setPreset(int index)
+    {
         if (index < 0 || index >= 3) return;
         const Preset& p = presets[index];
 
@@ -682,11 +549,11 @@ private:
 
         inputGainSlider.setRange(p.inputGainMin, p.inputGainMax, 0.01);
         inputGainSlider.setValue(p.inputGainDefault);
-        gain = p.inputGainDefault;
+        engine.setInputGain(p.inputGainDefault);
 
         outputGainSlider.setRange(p.outputGainMin, p.outputGainMax, 0.01);
         outputGainSlider.setValue(p.outputGainDefault);
-        outputGain = p.outputGainDefault;
+        engine.setOutputGain(p.outputGainDefault);
 
         lowQSlider.setRange(p.low.min, p.low.max, 0.01);
         lowQSlider.setValue(p.low.default);
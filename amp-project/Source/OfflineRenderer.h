@@ -0,0 +1,333 @@
+#pragma once
+#include <JuceHeader.h>
+#include <iostream>
+#include "AmpEngine.h"
+#include "Presets.h"
+#include "Profiles.h"
+
+// Renders WAV files through the amp chain without an audio device, as fast as
+// the machine allows. Every file gets its own engine so a folder can be
+// spread across all cores.
+class OfflineRenderer
+{
+public:
+    struct Settings
+    {
+        ProfileManager::UserProfile profile;
+        int presetIndex = 0;
+        juce::File irDirectory;
+        IRCache* irCache = nullptr;
+        int blockSize = 4096;
+        double tailSeconds = 0.0;
+    };
+
+    struct Result
+    {
+        juce::File input;
+        bool ok = false;
+        juce::String error;
+        double audioSeconds = 0.0;
+        double renderSeconds = 0.0;
+    };
+
+    static juce::ConsoleApplication::Command getCommand()
+    {
+        return { "--render",
+                 "--render <file|folder> --profile <profile.xml> [--output <folder>] [--irs <folder>] "
+                 "[--preset Marshall|Vox|Fender] [--block-size 4096] [--threads N] [--tail <seconds>]",
+                 "Renders WAV files through the amp chain faster than real time.",
+                 "Loads a profile saved by the Profiles menu and streams every input WAV through "
+                 "waveshaper, EQ, IRs and output gain in large blocks. Folders are rendered in parallel, "
+                 "one file per core, and the real-time factor is reported per file and for the batch.",
+                 [](const juce::ArgumentList& args) { run(args); } };
+    }
+
+    static void run(const juce::ArgumentList& args)
+    {
+        juce::File input = args.getFileForOption("--render");
+        if (!input.exists())
+            juce::ConsoleApplication::fail("Input not found: " + input.getFullPathName());
+
+        juce::File profileFile = args.getExistingFileForOption("--profile");
+        std::unique_ptr<juce::XmlElement> xml = juce::XmlDocument::parse(profileFile);
+        if (xml == nullptr || !xml->hasTagName("Profile"))
+            juce::ConsoleApplication::fail("Not a profile file: " + profileFile.getFullPathName());
+
+        Settings settings;
+        settings.profile = ProfileManager::loadProfileFromXml(xml.get());
+        settings.presetIndex = findPresetIndex(args.containsOption("--preset") ? args.getValueForOption("--preset")
+                                                                               : profileFile.getFileNameWithoutExtension());
+        if (settings.profile.cabinetIR.isNotEmpty() || settings.profile.reverbIR.isNotEmpty())
+            settings.irDirectory = findIRDirectory(args);
+        if (args.containsOption("--block-size"))
+            settings.blockSize = juce::jlimit(32, 65536, args.getValueForOption("--block-size").getIntValue());
+        if (args.containsOption("--tail"))
+            settings.tailSeconds = juce::jmax(0.0, args.getValueForOption("--tail").getDoubleValue());
+
+        juce::Array<juce::File> inputFiles;
+        if (input.isDirectory())
+            inputFiles = input.findChildFiles(juce::File::findFiles, false, "*.wav");
+        else
+            inputFiles.add(input);
+
+        if (inputFiles.isEmpty())
+            juce::ConsoleApplication::fail("No WAV files in " + input.getFullPathName());
+
+        juce::File outputDirectory = args.containsOption("--output")
+            ? args.getFileForOption("--output")
+            : (input.isDirectory() ? input : input.getParentDirectory()).getChildFile("rendered");
+        if (!outputDirectory.createDirectory())
+            juce::ConsoleApplication::fail("Could not create output folder: " + outputDirectory.getFullPathName());
+
+        int numThreads = juce::SystemStats::getNumCpus();
+        if (args.containsOption("--threads"))
+            numThreads = juce::jmax(1, args.getValueForOption("--threads").getIntValue());
+        numThreads = juce::jmin(numThreads, inputFiles.size());
+
+        std::cout << "Rendering " << inputFiles.size() << " file(s) with profile "
+                  << profileFile.getFileNameWithoutExtension() << " (" << presetNames[settings.presetIndex]
+                  << ") on " << numThreads << " thread(s)" << std::endl;
+
+        // Every file uses the same IRs, so decode them once for all threads
+        IRCache irCache;
+        settings.irCache = &irCache;
+
+        std::vector<Result> results((size_t)inputFiles.size());
+        juce::CriticalSection outputLock;
+        const double batchStart = juce::Time::getMillisecondCounterHiRes();
+
+        {
+            juce::ThreadPool pool(numThreads);
+            for (int i = 0; i < inputFiles.size(); ++i)
+            {
+                pool.addJob([&, i]()
+                {
+                    auto& result = results[(size_t)i];
+                    result = renderFile(inputFiles[i], outputDirectory.getChildFile(inputFiles[i].getFileName()), settings);
+
+                    const juce::ScopedLock sl(outputLock);
+                    printResult(result);
+                    return juce::ThreadPoolJob::jobHasFinished;
+                });
+            }
+
+            while (pool.getNumJobs() > 0)
+                juce::Thread::sleep(10);
+        }
+
+        const double batchSeconds = (juce::Time::getMillisecondCounterHiRes() - batchStart) / 1000.0;
+        double totalAudioSeconds = 0.0;
+        int numFailed = 0;
+        for (const auto& result : results)
+        {
+            totalAudioSeconds += result.audioSeconds;
+            numFailed += result.ok ? 0 : 1;
+        }
+
+        std::cout << "Rendered " << formatSeconds(totalAudioSeconds) << " of audio in " << formatSeconds(batchSeconds)
+                  << " (" << juce::String(totalAudioSeconds / juce::jmax(batchSeconds, 1.0e-6), 1) << "x real time)"
+                  << std::endl;
+
+        if (numFailed > 0)
+            juce::ConsoleApplication::fail(juce::String(numFailed) + " file(s) failed to render");
+    }
+
+    static Result renderFile(const juce::File& inputFile, const juce::File& outputFile, const Settings& settings)
+    {
+        Result result;
+        result.input = inputFile;
+        const double startTime = juce::Time::getMillisecondCounterHiRes();
+
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(inputFile));
+        if (reader == nullptr)
+        {
+            result.error = "unreadable audio file";
+            return result;
+        }
+
+        const double sampleRate = reader->sampleRate;
+        const juce::int64 inputLength = reader->lengthInSamples;
+
+        AmpEngine engine;
+        engine.prepare({ sampleRate, (juce::uint32)settings.blockSize, 2 });
+        if (!applySettings(engine, settings, result.error))
+            return result;
+
+        // Drop the engine latency from the start so re-amped tracks stay aligned with the DI
+        const juce::int64 latency = engine.getLatencyInSamples();
+        const juce::int64 outputLength = inputLength + (juce::int64)(settings.tailSeconds * sampleRate);
+        const juce::int64 totalLength = outputLength + latency;
+
+        outputFile.deleteFile();
+        std::unique_ptr<juce::FileOutputStream> stream(outputFile.createOutputStream());
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+        if (stream != nullptr)
+            writer.reset(juce::WavAudioFormat().createWriterFor(stream.get(), sampleRate, 2, 24, {}, 0));
+        if (writer == nullptr)
+        {
+            result.error = "could not write " + outputFile.getFullPathName();
+            return result;
+        }
+        stream.release();
+
+        juce::AudioBuffer<float> buffer(2, settings.blockSize);
+        juce::dsp::AudioBlock<float> fullBlock(buffer);
+
+        for (juce::int64 position = 0; position < totalLength; position += settings.blockSize)
+        {
+            const int numSamples = (int)juce::jmin((juce::int64)settings.blockSize, totalLength - position);
+            buffer.clear();
+            if (position < inputLength)
+                reader->read(&buffer, 0, (int)juce::jmin((juce::int64)numSamples, inputLength - position), position, true, true);
+
+            auto block = fullBlock.getSubBlock(0, (size_t)numSamples);
+            engine.process(block);
+            engine.clampOutput(block);
+
+            const int skip = (int)juce::jlimit((juce::int64)0, (juce::int64)numSamples, latency - position);
+            if (skip < numSamples)
+                writer->writeFromAudioSampleBuffer(buffer, skip, numSamples - skip);
+        }
+
+        result.ok = true;
+        result.audioSeconds = (double)outputLength / sampleRate;
+        result.renderSeconds = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+        return result;
+    }
+
+    // Mirrors ProfileManager::applyProfile on top of MainComponent::setPreset, minus the UI
+    static bool applySettings(AmpEngine& engine, const Settings& settings, juce::String& error)
+    {
+        const Preset& p = presets[settings.presetIndex];
+        const auto& profile = settings.profile;
+
+        auto& eq = engine.getToneStack();
+        eq.setlowFrequency(p.low.frequency);
+        eq.setlowQ((float)profile.lowQ);
+        eq.setmidFrequency(p.mid.frequency);
+        eq.setmidQ(p.mid.q);
+        eq.updatemidGain((float)profile.midGain);
+        eq.sethighFrequency(p.high.frequency);
+        eq.sethighQ(p.high.q);
+        eq.updatehighGain((float)profile.highGain);
+
+        auto& waveshaper = engine.getWaveshaper();
+        waveshaper.setPreEQFunction(ProfileManager::getWaveshapeFunction(
+            ProfileManager::getWaveshapeTypeFromName(profile.preEQFunctionName)));
+        waveshaper.setPostEQFunction(ProfileManager::getWaveshapeFunction(
+            ProfileManager::getWaveshapeTypeFromName(profile.postEQFunctionName)));
+
+        engine.setInputGain((float)profile.inputGain);
+        engine.setOutputGain((float)profile.outputGain);
+        engine.setOversamplingFactor(profile.oversampling);
+        engine.setAntiderivativeOrder(profile.antialiasing);
+
+        if (!engine.setSignalGraph(profile.signalGraph, error))
+        {
+            error = "bad signal graph: " + error;
+            return false;
+        }
+
+        if (!engine.waitForSignalGraph(10000))
+        {
+            error = "timed out compiling the signal graph";
+            return false;
+        }
+
+        auto& irProcessor = engine.getIRProcessor();
+        irProcessor.setCache(settings.irCache);
+        irProcessor.setReverbGain((float)profile.reverbGain);
+
+        if (profile.cabinetIR.isNotEmpty()
+            && !irProcessor.loadCabinetIR(settings.irDirectory.getChildFile("Cabinet").getChildFile(profile.cabinetIR + ".wav")))
+        {
+            error = "cabinet IR not found: " + profile.cabinetIR;
+            return false;
+        }
+
+        if (profile.reverbIR.isNotEmpty()
+            && !irProcessor.loadReverbIR(settings.irDirectory.getChildFile("Reverb").getChildFile(profile.reverbIR + ".wav")))
+        {
+            error = "reverb IR not found: " + profile.reverbIR;
+            return false;
+        }
+
+        if (!irProcessor.waitForPendingIRs(10000))
+        {
+            error = "timed out loading IRs";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Profiles are saved as "<preset>_<name>", so the prefix tells us which EQ voicing they were made with
+    static int findPresetIndex(const juce::String& name)
+    {
+        for (int i = 0; i < 3; ++i)
+            if (name.equalsIgnoreCase(presetNames[i]) || name.startsWithIgnoreCase(juce::String(presetNames[i]) + "_"))
+                return i;
+
+        return 0;
+    }
+
+    // The folder holding the Cabinet and Reverb IR folders: --irs if given, otherwise
+    // the first Source/IRs found walking up from the working directory, then from
+    // the executable, so a build run from anywhere in the checkout finds the bundled
+    // IRs. Fails the command rather than carrying on without IRs.
+    static juce::File findIRDirectory(const juce::ArgumentList& args)
+    {
+        auto hasIRs = [](const juce::File& folder)
+        {
+            return folder.getChildFile("Cabinet").isDirectory() || folder.getChildFile("Reverb").isDirectory();
+        };
+
+        if (args.containsOption("--irs"))
+        {
+            const juce::File folder = args.getExistingFolderForOption("--irs");
+            if (!hasIRs(folder))
+                juce::ConsoleApplication::fail("No Cabinet or Reverb folder in " + folder.getFullPathName());
+            return folder;
+        }
+
+        const juce::File starts[] = { juce::File::getCurrentWorkingDirectory(),
+                                      juce::File::getSpecialLocation(juce::File::currentExecutableFile).getParentDirectory() };
+        for (const auto& start : starts)
+        {
+            for (juce::File folder = start;; folder = folder.getParentDirectory())
+            {
+                for (const char* relative : { "IRs", "Source/IRs", "amp-project/Source/IRs" })
+                    if (hasIRs(folder.getChildFile(relative)))
+                        return folder.getChildFile(relative);
+
+                if (folder.isRoot())
+                    break;
+            }
+        }
+
+        juce::ConsoleApplication::fail("No IR folder found above the working directory or the executable; pass --irs <folder>");
+        return {};
+    }
+
+private:
+    static void printResult(const Result& result)
+    {
+        if (!result.ok)
+        {
+            std::cout << "  FAILED " << result.input.getFileName() << ": " << result.error << std::endl;
+            return;
+        }
+
+        std::cout << "  " << result.input.getFileName() << ": " << formatSeconds(result.audioSeconds) << " in "
+                  << formatSeconds(result.renderSeconds) << " ("
+                  << juce::String(result.audioSeconds / juce::jmax(result.renderSeconds, 1.0e-6), 1) << "x real time)"
+                  << std::endl;
+    }
+
+    static juce::String formatSeconds(double seconds)
+    {
+        return juce::String(seconds, 2) + " s";
+    }
+};
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+
+// Passes the latest value of something larger than an atomic, like a set of
+// filter coefficients, from one control thread to the audio thread without
+// locks or allocation. There are three preallocated slots: the writer fills
+// its own and swaps it with the shared one, and the reader swaps the shared
+// one into its own when it holds something newer. Neither side ever waits,
+// and neither ever touches the slot the other is using.
+template <typename Value>
+class ParameterHandoff
+{
+public:
+    ParameterHandoff() = default;
+
+    explicit ParameterHandoff(const Value& initial)
+    {
+        for (auto& slot : slots)
+            slot = initial;
+    }
+
+    // Writer thread only
+    void push(const Value& value)
+    {
+        slots[writeIndex] = value;
+        writeIndex = shared.exchange(writeIndex | newValueFlag, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Audio thread only. Returns true if current() changed.
+    bool pull()
+    {
+        if ((shared.load(std::memory_order_relaxed) & newValueFlag) == 0)
+            return false;
+
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+
+    // Audio thread only, the value as of the last pull()
+    const Value& current() const { return slots[readIndex]; }
+
+private:
+    static constexpr int indexMask = 3;
+    static constexpr int newValueFlag = 4;
+
+    Value slots[3]{};
+    int writeIndex = 0;
+    int readIndex = 1;
+    std::atomic<int> shared{ 2 };
+};
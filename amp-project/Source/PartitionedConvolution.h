@@ -0,0 +1,723 @@
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <vector>
+#include "RealtimeWorkerPool.h"
+#include "RealtimeSemaphore.h"
+#include "SIMDTarget.h"
+
+// Helpers for the spectra of a real FFT of 2 * (numBins - 1) points, stored as
+// numBins real parts followed by numBins imaginary parts so that the
+// multiply-accumulate vectorises
+namespace SplitSpectrum
+{
+    // A forward transform's output in scratch -> destination
+    inline void fromTransform(const float* scratch, float* destination, int numBins)
+    {
+        for (int k = 0; k < numBins; ++k)
+        {
+            destination[k] = scratch[2 * k];
+            destination[numBins + k] = scratch[2 * k + 1];
+        }
+    }
+
+    // spectrum -> scratch, rebuilding the negative frequencies the inverse transform expects
+    inline void toTransform(const float* spectrum, float* scratch, int numBins)
+    {
+        const int fftSize = 2 * (numBins - 1);
+        for (int k = 0; k < numBins; ++k)
+        {
+            scratch[2 * k] = spectrum[k];
+            scratch[2 * k + 1] = spectrum[numBins + k];
+        }
+        for (int k = 1; k < numBins - 1; ++k)
+        {
+            scratch[2 * (fftSize - k)] = scratch[2 * k];
+            scratch[2 * (fftSize - k) + 1] = -scratch[2 * k + 1];
+        }
+    }
+
+    inline void multiplyAccumulate(float* accumulator, const float* a, const float* b, int numBins)
+    {
+        float* accRe = accumulator;
+        float* accIm = accumulator + numBins;
+        const float* aRe = a;
+        const float* aIm = a + numBins;
+        const float* bRe = b;
+        const float* bIm = b + numBins;
+
+        for (int k = 0; k < numBins; ++k)
+        {
+            accRe[k] += aRe[k] * bRe[k] - aIm[k] * bIm[k];
+            accIm[k] += aRe[k] * bIm[k] + aIm[k] * bRe[k];
+        }
+    }
+}
+
+// Uniformly partitioned overlap-add convolution of one channel, with no added
+// latency. As in juce::dsp::Convolution, a partly filled input block is
+// transformed on every call, so callbacks shorter than the partition still get
+// their output straight away.
+class UniformConvolver
+{
+public:
+    // Not real-time: allocates. Splits the IR into partitions of partitionSize samples.
+    void prepare(const float* impulse, int length, int partitionSize)
+    {
+        blockSize = partitionSize;
+        fftSize = 2 * blockSize;
+        numBins = blockSize + 1;
+        fft = std::make_unique<juce::dsp::FFT>(juce::roundToInt(std::log2((double)fftSize)));
+        numSegments = juce::jmax(1, (length + blockSize - 1) / blockSize);
+
+        const size_t stride = (size_t)(2 * numBins);
+        impulseSegments.assign((size_t)numSegments * stride, 0.0f);
+        inputSegments.assign((size_t)numSegments * stride, 0.0f);
+        history.assign(stride, 0.0f);
+        spectrum.assign(stride, 0.0f);
+        scratch.assign((size_t)(2 * fftSize), 0.0f);
+        inputBuffer.assign((size_t)blockSize, 0.0f);
+        overlap.assign((size_t)blockSize, 0.0f);
+
+        for (int segment = 0; segment < numSegments; ++segment)
+        {
+            std::fill(scratch.begin(), scratch.end(), 0.0f);
+            const int offset = segment * blockSize;
+            std::copy(impulse + offset, impulse + juce::jmin(length, offset + blockSize), scratch.begin());
+            forward(getSegment(impulseSegments, segment));
+        }
+
+        reset();
+    }
+
+    void reset()
+    {
+        std::fill(inputSegments.begin(), inputSegments.end(), 0.0f);
+        std::fill(inputBuffer.begin(), inputBuffer.end(), 0.0f);
+        std::fill(overlap.begin(), overlap.end(), 0.0f);
+        inputPosition = 0;
+        currentSegment = 0;
+    }
+
+    // input and output may be the same buffer
+    void process(const float* input, float* output, int numSamples)
+    {
+        int done = 0;
+        while (done < numSamples)
+        {
+            const bool startsBlock = inputPosition == 0;
+            const int count = juce::jmin(numSamples - done, blockSize - inputPosition);
+            std::copy(input + done, input + done + count, inputBuffer.begin() + inputPosition);
+
+            std::fill(scratch.begin(), scratch.end(), 0.0f);
+            std::copy(inputBuffer.begin(), inputBuffer.end(), scratch.begin());
+            float* current = getSegment(inputSegments, currentSegment);
+            forward(current);
+
+            // Older blocks only change once per partition, so their sum is kept
+            if (startsBlock)
+            {
+                std::fill(history.begin(), history.end(), 0.0f);
+                for (int i = 1; i < numSegments; ++i)
+                    multiplyAccumulate(history.data(), getSegment(inputSegments, (currentSegment + i) % numSegments),
+                                       getSegment(impulseSegments, i));
+            }
+
+            std::copy(history.begin(), history.end(), spectrum.begin());
+            multiplyAccumulate(spectrum.data(), current, getSegment(impulseSegments, 0));
+            inverse();
+
+            for (int i = 0; i < count; ++i)
+                output[done + i] = scratch[(size_t)(inputPosition + i)] + overlap[(size_t)(inputPosition + i)];
+
+            inputPosition += count;
+            done += count;
+
+            if (inputPosition == blockSize)
+            {
+                std::copy(scratch.begin() + blockSize, scratch.begin() + fftSize, overlap.begin());
+                std::fill(inputBuffer.begin(), inputBuffer.end(), 0.0f);
+                inputPosition = 0;
+                currentSegment = currentSegment > 0 ? currentSegment - 1 : numSegments - 1;
+            }
+        }
+    }
+
+private:
+    float* getSegment(std::vector<float>& segments, int index) { return segments.data() + (size_t)index * (size_t)(2 * numBins); }
+
+    // scratch (time domain) -> destination, real parts then imaginary parts
+    void forward(float* destination)
+    {
+        fft->performRealOnlyForwardTransform(scratch.data(), true);
+        SplitSpectrum::fromTransform(scratch.data(), destination, numBins);
+    }
+
+    // spectrum -> scratch (time domain)
+    void inverse()
+    {
+        SplitSpectrum::toTransform(spectrum.data(), scratch.data(), numBins);
+        fft->performRealOnlyInverseTransform(scratch.data());
+    }
+
+    void multiplyAccumulate(float* accumulator, const float* a, const float* b) const
+    {
+        SplitSpectrum::multiplyAccumulate(accumulator, a, b, numBins);
+    }
+
+    std::unique_ptr<juce::dsp::FFT> fft;
+    int blockSize = 0, fftSize = 0, numBins = 0, numSegments = 0;
+    int inputPosition = 0, currentSegment = 0;
+    std::vector<float> impulseSegments, inputSegments, history, spectrum, scratch, inputBuffer, overlap;
+};
+
+// Time-domain FIR for the first few taps of an IR, four outputs at a time.
+// Unlike an FFT partition it needs no input block to fill up, so it adds no
+// latency and costs the same on every call.
+class DirectFormFIR
+{
+public:
+    // Not real-time. process() may then be given up to maxBlockSize samples at a time.
+    void prepare(const float* impulse, int length, int maxBlockSize)
+    {
+        numTaps = juce::jmax(1, length);
+        reversedTaps.assign((size_t)numTaps, 0.0f);
+        for (int k = 0; k < length; ++k)
+            reversedTaps[(size_t)(numTaps - 1 - k)] = impulse[k];
+
+        line.assign((size_t)(numTaps - 1 + maxBlockSize), 0.0f);
+    }
+
+    void reset()
+    {
+        std::fill(line.begin(), line.end(), 0.0f);
+    }
+
+    // input and output may be the same buffer
+    void process(const float* input, float* output, int numSamples)
+    {
+        // line holds the last numTaps - 1 inputs, then this block
+        const int history = numTaps - 1;
+        std::copy(input, input + numSamples, line.begin() + history);
+        const float* taps = reversedTaps.data();
+        const float* x = line.data();
+
+        int n = 0;
+       #if AMP_SIMD_FLOAT4
+        for (; n + 4 <= numSamples; n += 4)
+        {
+            auto sum = Float4::broadcast(0.0f);
+            for (int k = 0; k < numTaps; ++k)
+                sum = Float4::add(sum, Float4::mul(Float4::broadcast(taps[k]), Float4::load(x + n + k)));
+            Float4::store(output + n, sum);
+        }
+       #endif
+
+        for (; n < numSamples; ++n)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < numTaps; ++k)
+                sum += taps[k] * x[n + k];
+            output[n] = sum;
+        }
+
+        std::copy(line.begin() + numSamples, line.begin() + numSamples + history, line.begin());
+    }
+
+private:
+    int numTaps = 1;
+    std::vector<float> reversedTaps, line;
+};
+
+// The tail partitions of one channel, always run a whole block at a time.
+// The expensive part of a block, compute(), only reads the block's input and
+// the spectra of earlier blocks, and writes only to the Workspace it is
+// given. commit() then stores the block's spectrum and writes its output.
+// Any thread can compute a block into its own Workspace, and every thread
+// gets the same result, so the audio thread can always compute a block
+// itself instead of waiting for a worker.
+class TailConvolver
+{
+public:
+    // Spectra kept beyond the ones the next block needs, so a late computation
+    // can still read its inputs after the audio thread has committed that many
+    // more blocks
+    static constexpr int numSpareSegments = 2;
+
+    struct Workspace
+    {
+        // Each workspace gets its own FFT, since JUCE's fallback FFT locks around a transform
+        std::unique_ptr<juce::dsp::FFT> fft;
+        std::vector<float> scratch, spectrum, accumulator, result;
+    };
+
+    // Not real-time: allocates. Splits the IR into partitions of partitionSize samples.
+    void prepare(const float* impulse, int length, int partitionSize)
+    {
+        blockSize = partitionSize;
+        fftOrder = juce::roundToInt(std::log2((double)(2 * blockSize)));
+        numBins = blockSize + 1;
+        numSegments = juce::jmax(1, (length + blockSize - 1) / blockSize);
+        numSlots = numSegments - 1 + numSpareSegments;
+
+        const size_t stride = (size_t)(2 * numBins);
+        impulseSegments.assign((size_t)numSegments * stride, 0.0f);
+        slots.assign((size_t)numSlots * stride, 0.0f);
+        overlap.assign((size_t)blockSize, 0.0f);
+
+        Workspace workspace;
+        prepareWorkspace(workspace);
+        for (int segment = 0; segment < numSegments; ++segment)
+        {
+            std::fill(workspace.scratch.begin(), workspace.scratch.end(), 0.0f);
+            const int offset = segment * blockSize;
+            std::copy(impulse + offset, impulse + juce::jmin(length, offset + blockSize), workspace.scratch.begin());
+            workspace.fft->performRealOnlyForwardTransform(workspace.scratch.data(), true);
+            SplitSpectrum::fromTransform(workspace.scratch.data(), impulseSegments.data() + (size_t)segment * stride, numBins);
+        }
+    }
+
+    // Not real-time: allocates
+    void prepareWorkspace(Workspace& workspace) const
+    {
+        workspace.fft = std::make_unique<juce::dsp::FFT>(fftOrder);
+        workspace.scratch.assign((size_t)(4 * blockSize), 0.0f);
+        workspace.spectrum.assign((size_t)(2 * numBins), 0.0f);
+        workspace.accumulator.assign((size_t)(2 * numBins), 0.0f);
+        workspace.result.assign((size_t)(2 * blockSize), 0.0f);
+    }
+
+    // Audio thread, while no computation is running
+    void reset()
+    {
+        std::fill(slots.begin(), slots.end(), 0.0f);
+        std::fill(overlap.begin(), overlap.end(), 0.0f);
+    }
+
+    // Any thread. Convolves block number `block` of the input, blockSize samples,
+    // reading the spectra committed for the blocks before it.
+    void compute(const float* input, juce::int64 block, Workspace& workspace) const
+    {
+        auto& scratch = workspace.scratch;
+        std::fill(scratch.begin(), scratch.end(), 0.0f);
+        std::copy(input, input + blockSize, scratch.begin());
+        workspace.fft->performRealOnlyForwardTransform(scratch.data(), true);
+        SplitSpectrum::fromTransform(scratch.data(), workspace.spectrum.data(), numBins);
+
+        float* accumulator = workspace.accumulator.data();
+        std::fill(workspace.accumulator.begin(), workspace.accumulator.end(), 0.0f);
+        SplitSpectrum::multiplyAccumulate(accumulator, workspace.spectrum.data(), getImpulseSegment(0), numBins);
+        for (int i = 1; i < numSegments; ++i)
+            SplitSpectrum::multiplyAccumulate(accumulator, getSlot(block - i), getImpulseSegment(i), numBins);
+
+        SplitSpectrum::toTransform(accumulator, scratch.data(), numBins);
+        workspace.fft->performRealOnlyInverseTransform(scratch.data());
+        std::copy(scratch.begin(), scratch.begin() + 2 * blockSize, workspace.result.begin());
+    }
+
+    // Audio thread, once per block in order: keeps the block's spectrum for the
+    // blocks after it and writes its blockSize samples of output.
+    void commit(const Workspace& workspace, juce::int64 block, float* output)
+    {
+        std::copy(workspace.spectrum.begin(), workspace.spectrum.end(), getSlot(block));
+        for (int i = 0; i < blockSize; ++i)
+            output[i] = workspace.result[(size_t)i] + overlap[(size_t)i];
+        std::copy(workspace.result.begin() + blockSize, workspace.result.end(), overlap.begin());
+    }
+
+private:
+    const float* getImpulseSegment(int index) const { return impulseSegments.data() + (size_t)index * (size_t)(2 * numBins); }
+
+    float* getSlot(juce::int64 block) { return slots.data() + (size_t)(((block % numSlots) + numSlots) % numSlots) * (size_t)(2 * numBins); }
+    const float* getSlot(juce::int64 block) const { return const_cast<TailConvolver*>(this)->getSlot(block); }
+
+    int blockSize = 0, fftOrder = 0, numBins = 0, numSegments = 0, numSlots = 0;
+    std::vector<float> impulseSegments, slots, overlap;
+};
+
+// Convolution for long IRs, in three parts:
+//
+//  - the first P taps as a direct-form FIR, so the output has no latency
+//  - taps P to 2L in FFT partitions of P, each computed once its input block
+//    is complete and played over the next P samples
+//  - everything after 2L in partitions of L on a worker thread
+//
+// A tail job is posted as soon as its input block is complete and its output
+// is only needed one tail block later, so the worker has a whole block's worth
+// of time for it. The audio thread never waits for the worker. If the job
+// isn't finished when its output is due, the audio thread computes it itself
+// from the same input. A job the worker is still running is left to finish
+// and its result is thrown away. Either way the same code computes the same
+// result, so the output doesn't depend on thread timing. The one exception is
+// a worker stalled for more than TailConvolver::numSpareSegments tail blocks:
+// the tail is then muted until the worker returns, and restarts from silence.
+//
+// With zeroLatency off the FIR is skipped and the IR starts P samples late,
+// which saves the FIR's cost for a latency of P.
+class PartitionedConvolution
+{
+public:
+    PartitionedConvolution() = default;
+
+    ~PartitionedConvolution()
+    {
+        stopWorker();
+    }
+
+    // The FIR length and FFT partition size for a device block size
+    static int getHeadSize(const juce::dsp::ProcessSpec& spec)
+    {
+        return juce::jlimit(64, 256, (int)juce::nextPowerOfTwo((int)spec.maximumBlockSize));
+    }
+
+    // Not real-time. The IR has one channel for all, or one per channel, at the spec's rate.
+    void prepare(const juce::dsp::ProcessSpec& spec, const juce::AudioBuffer<float>& impulse, bool shouldBeZeroLatency = true)
+    {
+        stopWorker();
+
+        zeroLatency = shouldBeZeroLatency;
+        irSize = impulse.getNumSamples();
+        headSize = getHeadSize(spec);
+        tailBlockSize = juce::jlimit(1024, 8192, 4 * (int)juce::nextPowerOfTwo((int)spec.maximumBlockSize));
+
+        // Without the FIR the IR is shifted P samples later, so the FFT partitions cover it from the start
+        const int offset = zeroLatency ? 0 : headSize;
+        const int length = irSize + offset;
+        const int midEnd = juce::jmin(length, 2 * tailBlockSize);
+        hasMid = length > headSize;
+        hasTail = length > midEnd;
+
+        std::vector<float> shifted((size_t)length);
+        channels.resize(spec.numChannels);
+        for (size_t channel = 0; channel < channels.size(); ++channel)
+        {
+            const float* source = impulse.getReadPointer(juce::jmin((int)channel, impulse.getNumChannels() - 1));
+            std::fill(shifted.begin(), shifted.begin() + offset, 0.0f);
+            std::copy(source, source + irSize, shifted.begin() + offset);
+            const float* ir = shifted.data();
+
+            auto& c = channels[channel];
+            c.fir.prepare(ir, juce::jmin(length, headSize), headSize);
+            if (hasMid)
+                c.mid.prepare(ir + headSize, midEnd - headSize, headSize);
+            if (hasTail)
+            {
+                c.tail.prepare(ir + midEnd, length - midEnd, tailBlockSize);
+                c.tail.prepareWorkspace(c.workerSpace);
+                c.tail.prepareWorkspace(c.audioSpace);
+            }
+
+            for (auto* buffer : { &c.midInput, &c.midOutput })
+                buffer->assign((size_t)headSize, 0.0f);
+            for (auto* buffer : { &c.tailInput, &c.tailOutput, &c.jobInput, &c.audioInput })
+                buffer->assign(hasTail ? (size_t)tailBlockSize : 0, 0.0f);
+        }
+
+        reset();
+
+        if (hasTail)
+            worker.startThread(juce::Thread::Priority::high);
+    }
+
+    // Not while processing
+    void reset()
+    {
+        // Take back a job the worker hasn't started, and let one it has finish
+        for (;;)
+        {
+            int expected = posted;
+            if (jobState.compare_exchange_strong(expected, idle) || expected != running)
+                break;
+            juce::Thread::yield();
+        }
+
+        for (auto& c : channels)
+        {
+            c.fir.reset();
+            if (hasMid)
+                c.mid.reset();
+            if (hasTail)
+                c.tail.reset();
+            for (auto* buffer : { &c.midInput, &c.midOutput, &c.tailInput, &c.tailOutput, &c.jobInput, &c.audioInput })
+                std::fill(buffer->begin(), buffer->end(), 0.0f);
+        }
+
+        tailPosition = 0;
+        tailBlock = 0;
+        pendingJob = Pending::none;
+        workerAbandoned = false;
+        tailMuted = false;
+        jobState = idle;
+    }
+
+    // The channels are independent, so with a pool they run concurrently
+    void process(juce::dsp::AudioBlock<float>& block, RealtimeWorkerPool* pool = nullptr)
+    {
+        const int numChannels = juce::jmin((int)block.getNumChannels(), (int)channels.size());
+        const int numSamples = (int)block.getNumSamples();
+        auto forEachChannel = [numChannels, pool](auto& fn)
+        {
+            if (pool != nullptr)
+                pool->run(numChannels, fn);
+            else
+                for (int channel = 0; channel < numChannels; ++channel)
+                    fn(channel);
+        };
+
+        // Split at tail block boundaries, so jobs line up with the sample count and not with the callbacks
+        int done = 0;
+        while (done < numSamples)
+        {
+            const int count = juce::jmin(numSamples - done, tailBlockSize - tailPosition);
+            auto processSegment = [this, &block, done, count](int channel)
+            {
+                processChannel(channels[(size_t)channel], block.getChannelPointer((size_t)channel) + done, count);
+            };
+            forEachChannel(processSegment);
+
+            tailPosition += count;
+            done += count;
+
+            if (tailPosition == tailBlockSize)
+            {
+                tailPosition = 0;
+                if (hasTail)
+                    finishTailBlock();
+            }
+        }
+    }
+
+    int getIRSize() const { return irSize; }
+
+    // 0, or the partition size when zero latency is off
+    int getLatency() const { return zeroLatency ? 0 : headSize; }
+
+    // How many tail jobs the audio thread computed itself because the worker hadn't finished them
+    int getNumMissedJobs() const { return numMissedJobs.load(); }
+
+    // How many times a stalled worker left the tail muted
+    int getNumMutedTails() const { return numMutedTails.load(); }
+
+private:
+    enum JobState { idle, posted, running, done };
+
+    // Who computes the job for the last completed tail block
+    enum class Pending { none, worker, audioThread };
+
+    struct Channel
+    {
+        DirectFormFIR fir;
+        UniformConvolver mid;
+        TailConvolver tail;
+        std::vector<float> midInput, midOutput;                 // Audio thread
+        std::vector<float> tailInput, tailOutput, audioInput;   // Audio thread
+        std::vector<float> jobInput;                            // Read by whoever computes the posted job
+        TailConvolver::Workspace workerSpace;                   // Whoever holds the posted job
+        TailConvolver::Workspace audioSpace;                    // Audio thread
+    };
+
+    // One channel's samples from tailPosition on, never past the end of the tail block
+    void processChannel(Channel& c, float* data, int count)
+    {
+        int offset = 0;
+        while (offset < count)
+        {
+            const int position = tailPosition + offset;
+            const int midPosition = position % headSize;
+            const int n = juce::jmin(count - offset, headSize - midPosition);
+            float* chunk = data + offset;
+
+            std::copy(chunk, chunk + n, c.midInput.begin() + midPosition);
+            if (hasTail)
+                std::copy(chunk, chunk + n, c.tailInput.begin() + position);
+
+            if (zeroLatency)
+                c.fir.process(chunk, chunk, n);
+            else
+                std::fill(chunk, chunk + n, 0.0f);
+
+            juce::FloatVectorOperations::add(chunk, c.midOutput.data() + midPosition, n);
+            if (hasTail)
+                juce::FloatVectorOperations::add(chunk, c.tailOutput.data() + position, n);
+
+            // The block just completed plays over the next P samples
+            if (hasMid && midPosition + n == headSize)
+                c.mid.process(c.midInput.data(), c.midOutput.data(), headSize);
+
+            offset += n;
+        }
+    }
+
+    // Audio thread, each time a tail block of input is complete: the previous
+    // block's job is due, and this block's is handed out
+    void finishTailBlock()
+    {
+        // A job given up on earlier may have finished since
+        if (workerAbandoned && jobState.load(std::memory_order_acquire) == done)
+        {
+            jobState.store(idle, std::memory_order_relaxed);
+            workerAbandoned = false;
+        }
+
+        if (tailMuted)
+        {
+            if (workerAbandoned)
+            {
+                ++tailBlock;
+                return;
+            }
+
+            for (auto& c : channels)
+                c.tail.reset();
+            tailMuted = false;
+        }
+        else
+        {
+            collectJob(tailBlock - 1);
+        }
+
+        postJob(tailBlock);
+        ++tailBlock;
+    }
+
+    void collectJob(juce::int64 block)
+    {
+        bool useWorkerResult = false;
+        if (pendingJob == Pending::worker)
+        {
+            int expected = posted;
+            if (jobState.compare_exchange_strong(expected, idle, std::memory_order_acquire))
+            {
+                // Not started, so the worker's workspace is ours
+                for (auto& c : channels)
+                    c.tail.compute(c.jobInput.data(), block, c.workerSpace);
+                useWorkerResult = true;
+                ++numMissedJobs;
+            }
+            else if (expected == done)
+            {
+                jobState.store(idle, std::memory_order_relaxed);
+                useWorkerResult = true;
+            }
+            else
+            {
+                // Still running: compute it here from the same input rather than wait
+                for (auto& c : channels)
+                    c.tail.compute(c.jobInput.data(), block, c.audioSpace);
+                workerAbandoned = true;
+                abandonedBlock = block;
+                ++numMissedJobs;
+            }
+        }
+        else if (pendingJob == Pending::audioThread)
+        {
+            for (auto& c : channels)
+                c.tail.compute(c.audioInput.data(), block, c.audioSpace);
+        }
+        else
+        {
+            return;
+        }
+
+        // Committing overwrites the oldest spare spectrum, which a job abandoned
+        // this many blocks ago may still be reading
+        if (workerAbandoned && block >= abandonedBlock + TailConvolver::numSpareSegments)
+        {
+            for (auto& c : channels)
+                std::fill(c.tailOutput.begin(), c.tailOutput.end(), 0.0f);
+            tailMuted = true;
+            pendingJob = Pending::none;
+            ++numMutedTails;
+            return;
+        }
+
+        for (auto& c : channels)
+            c.tail.commit(useWorkerResult ? c.workerSpace : c.audioSpace, block, c.tailOutput.data());
+    }
+
+    void postJob(juce::int64 block)
+    {
+        if (tailMuted)
+            return;
+
+        // The worker's input stays untouched while it might still be reading it
+        if (workerAbandoned)
+        {
+            for (auto& c : channels)
+                std::swap(c.tailInput, c.audioInput);
+            pendingJob = Pending::audioThread;
+            return;
+        }
+
+        for (auto& c : channels)
+            std::swap(c.tailInput, c.jobInput);
+        jobBlock = block;
+        jobState.store(posted, std::memory_order_release);
+        wakeUp.signal();
+        pendingJob = Pending::worker;
+    }
+
+    void runJob()
+    {
+        for (auto& c : channels)
+            c.tail.compute(c.jobInput.data(), jobBlock, c.workerSpace);
+    }
+
+    void stopWorker()
+    {
+        worker.signalThreadShouldExit();
+        wakeUp.signal();
+        worker.stopThread(5000);
+    }
+
+    class Worker : public juce::Thread
+    {
+    public:
+        explicit Worker(PartitionedConvolution& ownerToServe) : juce::Thread("Convolution tail"), owner(ownerToServe) {}
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                // Signalled once per posted job; a job the audio thread took back leaves nothing to do
+                if (!owner.wakeUp.wait(-1) || threadShouldExit())
+                    continue;
+
+                int expected = posted;
+                if (owner.jobState.compare_exchange_strong(expected, running, std::memory_order_acquire))
+                {
+                    owner.runJob();
+                    owner.jobState.store(done, std::memory_order_release);
+                }
+            }
+        }
+
+    private:
+        PartitionedConvolution& owner;
+    };
+
+    std::vector<Channel> channels;
+    int irSize = 0;
+    int headSize = 64;
+    int tailBlockSize = 1024;
+    bool zeroLatency = true;
+    bool hasMid = false;
+    bool hasTail = false;
+    int tailPosition = 0;
+
+    // Audio thread
+    juce::int64 tailBlock = 0;          // The tail block being filled
+    juce::int64 abandonedBlock = 0;
+    Pending pendingJob = Pending::none;
+    bool workerAbandoned = false;       // The worker is still running a job whose result was computed here
+    bool tailMuted = false;
+
+    std::atomic<int> jobState{ idle };
+    juce::int64 jobBlock = 0;           // Published by the release store of posted
+    RealtimeSemaphore wakeUp;
+    std::atomic<int> numMissedJobs{ 0 };
+    std::atomic<int> numMutedTails{ 0 };
+    Worker worker{ *this };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PartitionedConvolution)
+};
@@ -0,0 +1,288 @@
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include <vector>
+
+// YIN pitch detection on its own thread. The audio thread only copies samples
+// into a lock-free FIFO. The detector low-passes them and keeps every
+// decimation-th sample, which puts the analysis at 8 kHz or just under. The
+// tuner only accepts pitches up to 1200 Hz, so nothing is lost. Each new
+// sample then slides the YIN difference function along by one: the term
+// leaving the window is subtracted and the one entering is added. A hop
+// costs a few hundred multiplies rather than a full recomputation.
+class PitchDetector : private juce::Thread
+{
+public:
+    static constexpr double targetRate = 8000.0;
+    static constexpr int windowSize = 256;      // Integration window, about 32 ms at the decimated rate
+    static constexpr int maxLag = 256;          // Down to ~30 Hz
+    static constexpr int hopSize = 32;          // A new estimate every ~4 ms
+
+    PitchDetector()
+        : juce::Thread("Pitch detector")
+    {
+        input.resize(inputBlockSize);
+        history.resize(2 * historySize);
+        difference.resize(maxLag);
+        normalised.resize(maxLag);
+    }
+
+    ~PitchDetector() override
+    {
+        stopThread(2000);
+    }
+
+    // Not while audio is running
+    void prepare(double sampleRate)
+    {
+        stopThread(2000);
+
+        decimation = juce::jmax(1, (int)std::ceil(sampleRate / targetRate));
+        decimatedRate = sampleRate / decimation;
+
+        // 4th order Butterworth, well below the decimated Nyquist
+        antiAlias[0].setCoefficients(juce::IIRCoefficients::makeLowPass(sampleRate, 1000.0, 0.5412));
+        antiAlias[1].setCoefficients(juce::IIRCoefficients::makeLowPass(sampleRate, 1000.0, 1.3066));
+        lowpass.setCoefficients(juce::IIRCoefficients::makeLowPass(decimatedRate, 600.0));
+        envelopeCoefficient = std::exp(-1.0f / (float)windowSize);
+
+        for (auto& filter : antiAlias)
+            filter.reset();
+        lowpass.reset();
+
+        fifo.reset();
+        std::fill(history.begin(), history.end(), 0.0f);
+        std::fill(difference.begin(), difference.end(), 0.0f);
+        newest = -1;
+        decimationPhase = 0;
+        hopPosition = 0;
+        hopsSinceRefresh = 0;
+        envelope = 0.0f;
+        stableFrameCount = 0;
+        lastRawPitch = 0.0f;
+        lastStablePitch = 0.0f;
+        frequency = 0.0f;
+
+        startThread(juce::Thread::Priority::low);
+    }
+
+    // Audio thread. Never blocks; samples that don't fit are dropped.
+    void push(const float* samples, int numSamples)
+    {
+        const auto scope = fifo.write(numSamples);
+        if (scope.blockSize1 > 0)
+            std::copy(samples, samples + scope.blockSize1, fifoBuffer + scope.startIndex1);
+        if (scope.blockSize2 > 0)
+            std::copy(samples + scope.blockSize1, samples + scope.blockSize1 + scope.blockSize2, fifoBuffer + scope.startIndex2);
+    }
+
+    // Any thread. The last stable pitch in Hz, or 0 while the input is quiet.
+    float getFrequency() const { return frequency.load(std::memory_order_relaxed); }
+
+private:
+    // The sample leaving the window, the window, and the newest lag partners
+    static constexpr int historySize = windowSize + maxLag;
+    static constexpr int inputBlockSize = 1024;
+    static constexpr int fifoSize = 16384;
+    static constexpr int refreshInterval = 256;     // Hops between exact recomputations, against float drift
+    static constexpr int pitchLockThreshold = 5;
+    static constexpr float pitchTolerance = 3.0f;
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            const int count = juce::jmin(fifo.getNumReady(), inputBlockSize);
+            if (count == 0)
+            {
+                wait(5);
+                continue;
+            }
+
+            const auto scope = fifo.read(count);
+            std::copy(fifoBuffer + scope.startIndex1, fifoBuffer + scope.startIndex1 + scope.blockSize1, input.data());
+            std::copy(fifoBuffer + scope.startIndex2, fifoBuffer + scope.startIndex2 + scope.blockSize2, input.data() + scope.blockSize1);
+
+            for (auto& filter : antiAlias)
+                filter.processSamples(input.data(), count);
+
+            for (int i = 0; i < count; ++i)
+            {
+                if (++decimationPhase < decimation)
+                    continue;
+
+                decimationPhase = 0;
+                addSample(input[(size_t)i]);
+            }
+        }
+    }
+
+    void addSample(float sample)
+    {
+        // Centre clipping strips the low-level detail that confuses YIN, and
+        // the lowpass takes out the harmonics it adds
+        envelope = envelopeCoefficient * envelope + (1.0f - envelopeCoefficient) * sample * sample;
+        const float threshold = juce::jlimit(0.02f, 0.2f, std::sqrt(envelope) * 0.6f);
+        float clipped = 0.0f;
+        if (sample > threshold)
+            clipped = sample - threshold;
+        else if (sample < -threshold)
+            clipped = sample + threshold;
+
+        ++newest;
+        const int slot = (int)(newest % historySize);
+        history[(size_t)slot] = history[(size_t)(slot + historySize)] = lowpass.processSingleSampleRaw(clipped);
+
+        slideDifference();
+
+        if (++hopPosition < hopSize)
+            return;
+
+        hopPosition = 0;
+        if (++hopsSinceRefresh >= refreshInterval)
+        {
+            hopsSinceRefresh = 0;
+            recomputeDifference();
+        }
+
+        analyse();
+    }
+
+    // d(tau) = sum over the window of (x[i] - x[i + tau])^2, where the window
+    // starts just after the oldest sample in the history
+    void slideDifference()
+    {
+        const float* x = oldest();
+        const float leaving = x[0];
+        const float entering = x[windowSize];
+
+        for (int tau = 1; tau < maxLag; ++tau)
+        {
+            const float gone = leaving - x[tau];
+            const float added = entering - x[windowSize + tau];
+            difference[(size_t)tau] += added * added - gone * gone;
+        }
+    }
+
+    void recomputeDifference()
+    {
+        const float* window = oldest() + 1;
+        for (int tau = 1; tau < maxLag; ++tau)
+        {
+            float sum = 0.0f;
+            for (int i = 0; i < windowSize; ++i)
+            {
+                const float diff = window[i] - window[i + tau];
+                sum += diff * diff;
+            }
+            difference[(size_t)tau] = sum;
+        }
+    }
+
+    // The sample that just left the window, followed by the whole window and
+    // its lag partners, contiguous thanks to the mirrored history
+    const float* oldest() const
+    {
+        return history.data() + (newest + 1) % historySize;
+    }
+
+    void analyse()
+    {
+        if (std::sqrt(envelope) <= 0.01f)
+        {
+            stableFrameCount = 0;
+            frequency = 0.0f;
+            return;
+        }
+
+        const float pitch = detectPitchYIN();
+        if (pitch > 40.0f && pitch < 1200.0f)
+        {
+            if (std::abs(pitch - lastRawPitch) < pitchTolerance)
+                ++stableFrameCount;
+            else
+                stableFrameCount = 0;
+
+            lastRawPitch = pitch;
+            if (stableFrameCount >= pitchLockThreshold)
+                lastStablePitch = pitch;
+        }
+        else
+        {
+            stableFrameCount = 0;
+        }
+
+        frequency = lastStablePitch;
+    }
+
+    float detectPitchYIN()
+    {
+        // Cumulative mean normalised difference
+        normalised[0] = 1.0f;
+        float runningSum = 0.0f;
+        for (int tau = 1; tau < maxLag; ++tau)
+        {
+            const float value = juce::jmax(0.0f, difference[(size_t)tau]);
+            runningSum += value;
+            normalised[(size_t)tau] = runningSum > 0.0f ? value * (float)tau / runningSum : 1.0f;
+        }
+
+        const float threshold = 0.1f;
+        for (int tau = 2; tau < maxLag; ++tau)
+        {
+            if (normalised[(size_t)tau] >= threshold)
+                continue;
+
+            while (tau + 1 < maxLag && normalised[(size_t)tau + 1] < normalised[(size_t)tau])
+                ++tau;
+
+            return (float)decimatedRate / refineLag(tau);
+        }
+
+        return 0.0f;
+    }
+
+    // The vertex of the parabola through the minimum and its two neighbours. The
+    // raw difference is used, since normalising skews the curve at short lags.
+    float refineLag(int tau) const
+    {
+        if (tau <= 1 || tau + 1 >= maxLag)
+            return (float)tau;
+
+        const float before = difference[(size_t)tau - 1];
+        const float at = difference[(size_t)tau];
+        const float after = difference[(size_t)tau + 1];
+        const float curvature = before - 2.0f * at + after;
+        if (curvature <= 0.0f)
+            return (float)tau;
+
+        return (float)tau + 0.5f * (before - after) / curvature;
+    }
+
+    int decimation = 1;
+    double decimatedRate = targetRate;
+
+    // Audio thread to detector
+    juce::AbstractFifo fifo{ fifoSize };
+    float fifoBuffer[fifoSize] = {};
+
+    // Detector thread
+    juce::IIRFilter antiAlias[2];
+    juce::IIRFilter lowpass;
+    float envelopeCoefficient = 0.0f;
+    float envelope = 0.0f;
+    std::vector<float> input;
+    std::vector<float> history;     // historySize samples, stored twice so any window is contiguous
+    std::vector<float> difference, normalised;
+    juce::int64 newest = -1;
+    int decimationPhase = 0;
+    int hopPosition = 0;
+    int hopsSinceRefresh = 0;
+    int stableFrameCount = 0;
+    float lastRawPitch = 0.0f;
+    float lastStablePitch = 0.0f;
+
+    std::atomic<float> frequency{ 0.0f };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PitchDetector)
+};
@@ -4,6 +4,7 @@
 #include "WaveshaperProcessor.h"
 #include "ToneStack.h"
 #include "IRProcessor.h"
+#include "AmpEngine.h"
 
 class ProfileManager
 {
@@ -21,6 +22,9 @@ public:
         juce::String reverbIR;
         juce::String preEQFunctionName;
         juce::String postEQFunctionName;
+        int oversampling;
+        int antialiasing;
+        juce::String signalGraph = SignalGraph::defaultChain;   // Stage order, as SignalGraph parses it
     };
 
     // Public enum declaration
@@ -32,21 +36,23 @@ public:
     };
 
     // Public static waveshaping functions
-    static float softClip(float sample) { return sample / (std::abs(sample) + 1.0f); }
-    static float hardClip(float sample) { return sample > 0.5f ? 0.5f : (sample < -0.5f ? -0.5f : sample); }
-    static float tanhClip(float sample) { return std::tanh(sample); }
+    static constexpr float(*softClip)(float) = Waveshapes::softClip;
+    static constexpr float(*hardClip)(float) = Waveshapes::hardClip;
+    static constexpr float(*tanhClip)(float) = Waveshapes::tanhClip;
 
     ProfileManager(juce::Slider& inputGainSlider, juce::Slider& outputGainSlider,
         juce::Slider& lowQSlider, juce::Slider& midGainSlider,
         juce::Slider& highGainSlider, juce::Slider& reverbGainSlider,
         juce::ComboBox& cabinetIrSelector, juce::ComboBox& reverbIrSelector,
-        WaveshaperProcessor& waveshaper, ToneStack& eq, IRProcessor& irProcessor,
+        juce::ComboBox& oversamplingSelector, juce::ComboBox& antialiasingSelector,
+        AmpEngine& engine,
         const juce::Array<juce::File>& cabinetIrFiles, const juce::Array<juce::File>& reverbIrFiles)
         : inputGainSlider(inputGainSlider), outputGainSlider(outputGainSlider),
         lowQSlider(lowQSlider), midGainSlider(midGainSlider),
         highGainSlider(highGainSlider), reverbGainSlider(reverbGainSlider),
         cabinetIrSelector(cabinetIrSelector), reverbIrSelector(reverbIrSelector),
-        waveshaper(waveshaper), eq(eq), irProcessor(irProcessor),
+        oversamplingSelector(oversamplingSelector), antialiasingSelector(antialiasingSelector),
+        engine(engine), waveshaper(engine.getWaveshaper()), eq(engine.getToneStack()), irProcessor(engine.getIRProcessor()),
         cabinetIrFiles(cabinetIrFiles), reverbIrFiles(reverbIrFiles)
     {
         // Load default profile name from config
@@ -88,6 +94,9 @@ public:
         profile.reverbIR = reverbIrSelector.getSelectedId() > 1 ? reverbIrFiles[reverbIrSelector.getSelectedId() - 2].getFileNameWithoutExtension() : "";
         profile.preEQFunctionName = getWaveshapeName(currentPreEQType);
         profile.postEQFunctionName = getWaveshapeName(currentPostEQType);
+        profile.oversampling = juce::jmax(1, oversamplingSelector.getSelectedId());
+        profile.antialiasing = juce::jmax(0, antialiasingSelector.getSelectedId() - 1);
+        profile.signalGraph = engine.getSignalGraph();
         return profile;
     }
 
@@ -136,6 +145,10 @@ public:
             reverbIrSelector.setSelectedId(1);
         }
 
+        // Selector item ids are the oversampling factors themselves
+        oversamplingSelector.setSelectedId(profile.oversampling);
+        antialiasingSelector.setSelectedId(profile.antialiasing + 1);
+
         WaveshapeType preEQType = getWaveshapeTypeFromName(profile.preEQFunctionName);
         waveshaper.setPreEQFunction(getWaveshapeFunction(preEQType));
         currentPreEQType = preEQType;
@@ -143,9 +156,16 @@ public:
         WaveshapeType postEQType = getWaveshapeTypeFromName(profile.postEQFunctionName);
         waveshaper.setPostEQFunction(getWaveshapeFunction(postEQType));
         currentPostEQType = postEQType;
+
+        juce::String error;
+        if (!engine.setSignalGraph(profile.signalGraph, error))
+        {
+            juce::Logger::writeToLog("Profile signal graph ignored: " + error);
+            engine.setSignalGraph(SignalGraph::defaultChain, error);
+        }
     }
 
-    std::unique_ptr<juce::XmlElement> saveProfileToXml(const UserProfile& profile)
+    static std::unique_ptr<juce::XmlElement> saveProfileToXml(const UserProfile& profile)
     {
         auto xml = std::make_unique<juce::XmlElement>("Profile");
         xml->setAttribute("inputGain", profile.inputGain);
@@ -158,10 +178,13 @@ public:
         xml->setAttribute("reverbIR", profile.reverbIR);
         xml->setAttribute("preEQFunction", profile.preEQFunctionName);
         xml->setAttribute("postEQFunction", profile.postEQFunctionName);
+        xml->setAttribute("oversampling", profile.oversampling);
+        xml->setAttribute("antialiasing", profile.antialiasing);
+        xml->setAttribute("signalGraph", profile.signalGraph);
         return xml;
     }
 
-    UserProfile loadProfileFromXml(const juce::XmlElement* xml)
+    static UserProfile loadProfileFromXml(const juce::XmlElement* xml)
     {
         UserProfile profile;
         if (xml)
@@ -176,6 +199,9 @@ public:
             profile.reverbIR = xml->getStringAttribute("reverbIR", "");
             profile.preEQFunctionName = xml->getStringAttribute("preEQFunction", "SoftClip");
             profile.postEQFunctionName = xml->getStringAttribute("postEQFunction", "SoftClip");
+            profile.oversampling = snapOversamplingFactor(xml->getIntAttribute("oversampling", 1));
+            profile.antialiasing = juce::jlimit(0, 2, xml->getIntAttribute("antialiasing", 0));
+            profile.signalGraph = xml->getStringAttribute("signalGraph", SignalGraph::defaultChain);
         }
         return profile;
     }
@@ -237,6 +263,8 @@ public:
         // Reset IR selections
         cabinetIrSelector.setSelectedId(1);
         reverbIrSelector.setSelectedId(1);
+        oversamplingSelector.setSelectedId(1);
+        antialiasingSelector.setSelectedId(1);
 
         // Reset processor states
         irProcessor.resetCabinetIR();
@@ -248,6 +276,9 @@ public:
         waveshaper.setPostEQFunction(softClip);
         currentPreEQType = SoftClip;
         currentPostEQType = SoftClip;
+
+        juce::String error;
+        engine.setSignalGraph(SignalGraph::defaultChain, error);
     }
 
     void showProfilesMenu(const juce::String& presetName)  // Add parameter here
@@ -334,6 +365,33 @@ public:
         currentPostEQType = static_cast<WaveshapeType>(postEQType);
     }
 
+    static float(*getWaveshapeFunction(WaveshapeType type))(float)
+    {
+        switch (type)
+        {
+        case WaveshapeType::SoftClip: return softClip;
+        case WaveshapeType::HardClip: return hardClip;
+        case WaveshapeType::TanhClip: return tanhClip;
+        default: return softClip;
+        }
+    }
+
+    static WaveshapeType getWaveshapeTypeFromName(const juce::String& name)
+    {
+        if (name == "SoftClip") return WaveshapeType::SoftClip;
+        if (name == "HardClip") return WaveshapeType::HardClip;
+        if (name == "TanhClip") return WaveshapeType::TanhClip;
+        return WaveshapeType::SoftClip;
+    }
+
+    // The nearest factor the selector offers, ties going up; profiles are edited by hand
+    static int snapOversamplingFactor(int factor)
+    {
+        const int limited = juce::jlimit(1, WaveshaperProcessor::maxOversamplingFactor, factor);
+        const int above = juce::nextPowerOfTwo(limited);
+        return above - limited > limited - above / 2 ? above / 2 : above;
+    }
+
 private:
     juce::String currentDefaultProfile;
     juce::String currentLoadedProfile;
@@ -350,23 +408,15 @@ private:
     juce::Slider& reverbGainSlider;
     juce::ComboBox& cabinetIrSelector;
     juce::ComboBox& reverbIrSelector;
+    juce::ComboBox& oversamplingSelector;
+    juce::ComboBox& antialiasingSelector;
+    AmpEngine& engine;
     WaveshaperProcessor& waveshaper;
     ToneStack& eq;
     IRProcessor& irProcessor;
     const juce::Array<juce::File>& cabinetIrFiles;
     const juce::Array<juce::File>& reverbIrFiles;
 
-    float(*getWaveshapeFunction(WaveshapeType type))(float)
-    {
-        switch (type)
-        {
-        case WaveshapeType::SoftClip: return softClip;
-        case WaveshapeType::HardClip: return hardClip;
-        case WaveshapeType::TanhClip: return tanhClip;
-        default: return softClip;
-        }
-    }
-
     juce::String getWaveshapeName(WaveshapeType type) const
     {
         switch (type)
@@ -378,14 +428,6 @@ private:
         }
     }
 
-    WaveshapeType getWaveshapeTypeFromName(const juce::String& name)
-    {
-        if (name == "SoftClip") return WaveshapeType::SoftClip;
-        if (name == "HardClip") return WaveshapeType::HardClip;
-        if (name == "TanhClip") return WaveshapeType::TanhClip;
-        return WaveshapeType::SoftClip;
-    }
-
     WaveshapeType getWaveshapeTypeFromFunction(float(*func)(float))
     {
         if (func == softClip) return WaveshapeType::SoftClip;
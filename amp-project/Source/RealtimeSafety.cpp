@@ -0,0 +1,528 @@
+#include "RealtimeSafety.h"
+
+#if AMP_REALTIME_CHECKS
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #include <windows.h>
+ #include <dbghelp.h>
+ #include <crtdbg.h>
+ #include <tlhelp32.h>
+ #include <cwchar>
+ #include <cstring>
+ #pragma comment (lib, "DbgHelp.lib")
+#else
+ #include <execinfo.h>
+#endif
+
+#if JUCE_LINUX && defined (__GLIBC__)
+ #include <dlfcn.h>
+ #include <fcntl.h>
+ #include <pthread.h>
+ #include <cstdarg>
+ #include <cstdio>
+ #include <unistd.h>
+ #define AMP_INTERPOSE_LIBC 1
+#elif JUCE_MSVC && defined (_DEBUG)
+ #define AMP_CRT_ALLOC_HOOK 1
+#else
+ #define AMP_REPLACE_OPERATOR_NEW 1
+#endif
+
+#if JUCE_WINDOWS
+ #define AMP_PATCH_WIN32_IMPORTS 1
+#endif
+
+namespace RealtimeSafety
+{
+    namespace
+    {
+        constexpr int maxFrames = 24;
+        constexpr int maxRecorded = 256;
+
+        struct Record
+        {
+            std::atomic<bool> ready{ false };
+            Kind kind = Kind::allocation;
+            const char* what = "";
+            int numFrames = 0;
+            void* frames[maxFrames] = {};
+        };
+
+        // Fixed storage, so recording never allocates
+        std::array<Record, maxRecorded> records;
+        std::atomic<int> numViolations{ 0 };
+
+        thread_local int audioThreadDepth = 0;
+        thread_local bool recording = false;
+
+        int captureStack(void** frames)
+        {
+           #if JUCE_WINDOWS
+            return (int)CaptureStackBackTrace(2, maxFrames, frames, nullptr);
+           #else
+            return backtrace(frames, maxFrames);
+           #endif
+        }
+
+        const char* describe(Kind kind)
+        {
+            switch (kind)
+            {
+                case Kind::allocation:   return "allocation";
+                case Kind::deallocation: return "deallocation";
+                case Kind::lock:         return "lock";
+                case Kind::fileAccess:   return "file access";
+            }
+            return "";
+        }
+
+        juce::String symbolise(const Record& record)
+        {
+            juce::String result;
+           #if JUCE_WINDOWS
+            auto process = GetCurrentProcess();
+            static const bool symbolsLoaded = SymInitialize(process, nullptr, TRUE) != FALSE;
+            juce::ignoreUnused(symbolsLoaded);
+
+            for (int i = 0; i < record.numFrames; ++i)
+            {
+                alignas(SYMBOL_INFO) char buffer[sizeof(SYMBOL_INFO) + 256] = {};
+                auto* symbol = reinterpret_cast<SYMBOL_INFO*>(buffer);
+                symbol->SizeOfStruct = sizeof(SYMBOL_INFO);
+                symbol->MaxNameLen = 255;
+
+                const auto address = (DWORD64)record.frames[i];
+                DWORD64 displacement = 0;
+                result << "    " << i << ": ";
+                if (SymFromAddr(process, address, &displacement, symbol))
+                    result << symbol->Name;
+                else
+                    result << juce::String::toHexString((juce::int64)address);
+
+                IMAGEHLP_LINE64 line = {};
+                line.SizeOfStruct = sizeof(line);
+                DWORD lineDisplacement = 0;
+                if (SymGetLineFromAddr64(process, address, &lineDisplacement, &line))
+                    result << " (" << juce::File(line.FileName).getFileName() << ":" << (int)line.LineNumber << ")";
+                result << juce::newLine;
+            }
+           #else
+            if (char** symbols = backtrace_symbols(record.frames, record.numFrames))
+            {
+                for (int i = 0; i < record.numFrames; ++i)
+                    result << "    " << i << ": " << symbols[i] << juce::newLine;
+                std::free(symbols);
+            }
+           #endif
+            return result;
+        }
+    }
+
+    void check(Kind kind, const char* what) noexcept
+    {
+        if (audioThreadDepth == 0 || recording)
+            return;
+
+        recording = true;
+        const int index = numViolations.fetch_add(1, std::memory_order_relaxed);
+        if (index < maxRecorded)
+        {
+            auto& record = records[(size_t)index];
+            record.kind = kind;
+            record.what = what;
+            record.numFrames = captureStack(record.frames);
+            record.ready.store(true, std::memory_order_release);
+        }
+        recording = false;
+    }
+
+    int getNumViolations() { return numViolations.load(); }
+
+    void clearViolations()
+    {
+        for (auto& record : records)
+            record.ready = false;
+        numViolations = 0;
+    }
+
+    juce::String getReport(int maxEntries)
+    {
+        const int total = numViolations.load();
+        juce::String report;
+        report << total << " real-time violation(s) on the audio thread" << juce::newLine;
+
+        // Group identical call sites so one allocation per block reads as one entry
+        struct Entry { const Record* record; int count; };
+        std::map<juce::String, Entry> entries;
+        std::vector<juce::String> order;
+        for (int i = 0; i < juce::jmin(total, maxRecorded); ++i)
+        {
+            const auto& record = records[(size_t)i];
+            if (!record.ready.load(std::memory_order_acquire))
+                continue;
+
+            juce::String key = juce::String((int)record.kind) + record.what;
+            for (int frame = 0; frame < record.numFrames; ++frame)
+                key << ":" << juce::String::toHexString((juce::pointer_sized_int)record.frames[frame]);
+
+            auto [it, added] = entries.insert({ key, { &record, 0 } });
+            ++it->second.count;
+            if (added)
+                order.push_back(key);
+        }
+
+        for (int i = 0; i < juce::jmin((int)order.size(), maxEntries); ++i)
+        {
+            const auto& entry = entries[order[(size_t)i]];
+            report << juce::newLine << describe(entry.record->kind) << " in " << entry.record->what
+                   << " (" << entry.count << "x)" << juce::newLine << symbolise(*entry.record);
+        }
+
+        if (total > maxRecorded)
+            report << juce::newLine << "Only the first " << maxRecorded << " were recorded" << juce::newLine;
+
+        return report;
+    }
+
+    ScopedAudioThread::ScopedAudioThread() { ++audioThreadDepth; }
+    ScopedAudioThread::~ScopedAudioThread() { --audioThreadDepth; }
+
+   #if AMP_CRT_ALLOC_HOOK
+    static int allocationHook(int allocType, void*, size_t, int blockType, long, const unsigned char*, int)
+    {
+        // The CRT's own bookkeeping blocks aren't the program's doing
+        if (blockType != _CRT_BLOCK)
+            check(allocType == _HOOK_FREE ? Kind::deallocation : Kind::allocation,
+                  allocType == _HOOK_ALLOC ? "malloc" : allocType == _HOOK_REALLOC ? "realloc" : "free");
+        return TRUE;
+    }
+   #endif
+
+   #if AMP_PATCH_WIN32_IMPORTS
+    // Windows has no symbol interposition, so install() points the import table
+    // entries of the executable and the C and C++ runtimes at these instead.
+    // That covers JUCE's locks and files, std::mutex and the CRT's file calls.
+    namespace Win32
+    {
+        decltype(&::EnterCriticalSection) realEnterCriticalSection = nullptr;
+        decltype(&::AcquireSRWLockExclusive) realAcquireSRWLockExclusive = nullptr;
+        decltype(&::AcquireSRWLockShared) realAcquireSRWLockShared = nullptr;
+        decltype(&::CreateFileW) realCreateFileW = nullptr;
+        decltype(&::CreateFileA) realCreateFileA = nullptr;
+        decltype(&::ReadFile) realReadFile = nullptr;
+        decltype(&::WriteFile) realWriteFile = nullptr;
+
+        void WINAPI enterCriticalSection(LPCRITICAL_SECTION section)
+        {
+            check(Kind::lock, "EnterCriticalSection");
+            realEnterCriticalSection(section);
+        }
+
+        void WINAPI acquireSRWLockExclusive(PSRWLOCK lock)
+        {
+            check(Kind::lock, "AcquireSRWLockExclusive");
+            realAcquireSRWLockExclusive(lock);
+        }
+
+        void WINAPI acquireSRWLockShared(PSRWLOCK lock)
+        {
+            check(Kind::lock, "AcquireSRWLockShared");
+            realAcquireSRWLockShared(lock);
+        }
+
+        HANDLE WINAPI createFileW(LPCWSTR name, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES security,
+                                  DWORD disposition, DWORD flags, HANDLE templateFile)
+        {
+            check(Kind::fileAccess, "CreateFileW");
+            return realCreateFileW(name, access, share, security, disposition, flags, templateFile);
+        }
+
+        HANDLE WINAPI createFileA(LPCSTR name, DWORD access, DWORD share, LPSECURITY_ATTRIBUTES security,
+                                  DWORD disposition, DWORD flags, HANDLE templateFile)
+        {
+            check(Kind::fileAccess, "CreateFileA");
+            return realCreateFileA(name, access, share, security, disposition, flags, templateFile);
+        }
+
+        BOOL WINAPI readFile(HANDLE file, LPVOID buffer, DWORD size, LPDWORD numRead, LPOVERLAPPED overlapped)
+        {
+            check(Kind::fileAccess, "ReadFile");
+            return realReadFile(file, buffer, size, numRead, overlapped);
+        }
+
+        BOOL WINAPI writeFile(HANDLE file, LPCVOID buffer, DWORD size, LPDWORD numWritten, LPOVERLAPPED overlapped)
+        {
+            check(Kind::fileAccess, "WriteFile");
+            return realWriteFile(file, buffer, size, numWritten, overlapped);
+        }
+
+        struct Hook
+        {
+            const char* name;
+            void* replacement;
+            void** real;
+        };
+
+        const Hook hooks[] = {
+            { "EnterCriticalSection",    (void*)&enterCriticalSection,    (void**)&realEnterCriticalSection },
+            { "AcquireSRWLockExclusive", (void*)&acquireSRWLockExclusive, (void**)&realAcquireSRWLockExclusive },
+            { "AcquireSRWLockShared",    (void*)&acquireSRWLockShared,    (void**)&realAcquireSRWLockShared },
+            { "CreateFileW",             (void*)&createFileW,             (void**)&realCreateFileW },
+            { "CreateFileA",             (void*)&createFileA,             (void**)&realCreateFileA },
+            { "ReadFile",                (void*)&readFile,                (void**)&realReadFile },
+            { "WriteFile",               (void*)&writeFile,               (void**)&realWriteFile },
+        };
+
+        // Rewrites every by-name import of a hooked function in one module
+        void patchImports(HMODULE module)
+        {
+            auto* base = reinterpret_cast<BYTE*>(module);
+            auto* dosHeader = reinterpret_cast<IMAGE_DOS_HEADER*>(base);
+            if (dosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+                return;
+
+            auto* ntHeaders = reinterpret_cast<IMAGE_NT_HEADERS*>(base + dosHeader->e_lfanew);
+            const auto& imports = ntHeaders->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT];
+            if (imports.VirtualAddress == 0)
+                return;
+
+            for (auto* descriptor = reinterpret_cast<IMAGE_IMPORT_DESCRIPTOR*>(base + imports.VirtualAddress); descriptor->Name != 0; ++descriptor)
+            {
+                if (descriptor->OriginalFirstThunk == 0)
+                    continue;
+
+                auto* names = reinterpret_cast<IMAGE_THUNK_DATA*>(base + descriptor->OriginalFirstThunk);
+                auto* slots = reinterpret_cast<IMAGE_THUNK_DATA*>(base + descriptor->FirstThunk);
+                for (; names->u1.AddressOfData != 0; ++names, ++slots)
+                {
+                    if (IMAGE_SNAP_BY_ORDINAL(names->u1.Ordinal))
+                        continue;
+
+                    const auto* name = reinterpret_cast<const char*>(reinterpret_cast<IMAGE_IMPORT_BY_NAME*>(base + names->u1.AddressOfData)->Name);
+                    for (const auto& hook : hooks)
+                    {
+                        if (std::strcmp(name, hook.name) != 0 || *hook.real == nullptr)
+                            continue;
+
+                        DWORD protection = 0;
+                        if (VirtualProtect(&slots->u1.Function, sizeof(slots->u1.Function), PAGE_READWRITE, &protection))
+                        {
+                            slots->u1.Function = (ULONG_PTR)hook.replacement;
+                            VirtualProtect(&slots->u1.Function, sizeof(slots->u1.Function), protection, &protection);
+                        }
+                    }
+                }
+            }
+        }
+
+        // The executable, where JUCE is linked statically, and the runtime DLLs
+        // that std::mutex and the CRT's file functions live in
+        bool shouldPatch(const wchar_t* moduleName, HMODULE module)
+        {
+            if (module == GetModuleHandleW(nullptr))
+                return true;
+
+            for (const wchar_t* prefix : { L"msvcp", L"vcruntime", L"ucrtbase" })
+                if (_wcsnicmp(moduleName, prefix, std::wcslen(prefix)) == 0)
+                    return true;
+            return false;
+        }
+
+        void install()
+        {
+            // Whichever api-ms-win-* set a module imports from, these all end up in kernel32's exports
+            const HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll");
+            for (const auto& hook : hooks)
+                *hook.real = (void*)GetProcAddress(kernel32, hook.name);
+
+            const HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+            if (snapshot == INVALID_HANDLE_VALUE)
+                return;
+
+            MODULEENTRY32W entry = {};
+            entry.dwSize = sizeof(entry);
+            for (BOOL more = Module32FirstW(snapshot, &entry); more; more = Module32NextW(snapshot, &entry))
+                if (shouldPatch(entry.szModule, entry.hModule))
+                    patchImports(entry.hModule);
+
+            CloseHandle(snapshot);
+        }
+    }
+   #endif
+
+   #if AMP_INTERPOSE_LIBC
+    template <typename Function>
+    static Function next(const char* name)
+    {
+        return reinterpret_cast<Function>(dlsym(RTLD_NEXT, name));
+    }
+   #endif
+
+    void install()
+    {
+        // The first backtrace() can load its unwinder, which allocates; get that done now
+        void* frames[maxFrames];
+        juce::ignoreUnused(captureStack(frames));
+
+       #if AMP_CRT_ALLOC_HOOK
+        _CrtSetAllocHook(allocationHook);
+       #endif
+
+       #if AMP_PATCH_WIN32_IMPORTS
+        Win32::install();
+       #endif
+    }
+}
+
+#if AMP_INTERPOSE_LIBC
+// Definitions in the executable win over glibc's, which stay reachable
+// through their __libc_ names or RTLD_NEXT
+extern "C"
+{
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void __libc_free(void*);
+
+    void* malloc(size_t size)
+    {
+        RealtimeSafety::check(RealtimeSafety::Kind::allocation, "malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t count, size_t size)
+    {
+        RealtimeSafety::check(RealtimeSafety::Kind::allocation, "calloc");
+        return __libc_calloc(count, size);
+    }
+
+    void* realloc(void* pointer, size_t size)
+    {
+        RealtimeSafety::check(RealtimeSafety::Kind::allocation, "realloc");
+        return __libc_realloc(pointer, size);
+    }
+
+    void free(void* pointer)
+    {
+        if (pointer != nullptr)
+            RealtimeSafety::check(RealtimeSafety::Kind::deallocation, "free");
+        __libc_free(pointer);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex)
+    {
+        static const auto real = RealtimeSafety::next<int (*)(pthread_mutex_t*)>("pthread_mutex_lock");
+        RealtimeSafety::check(RealtimeSafety::Kind::lock, "pthread_mutex_lock");
+        return real(mutex);
+    }
+
+    int open(const char* path, int flags, ...)
+    {
+        static const auto real = RealtimeSafety::next<int (*)(const char*, int, ...)>("open");
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "open");
+
+        mode_t mode = 0;
+        if ((flags & O_CREAT) != 0)
+        {
+            va_list args;
+            va_start(args, flags);
+            mode = (mode_t)va_arg(args, int);
+            va_end(args);
+        }
+        return real(path, flags, mode);
+    }
+
+    FILE* fopen(const char* path, const char* mode)
+    {
+        static const auto real = RealtimeSafety::next<FILE* (*)(const char*, const char*)>("fopen");
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "fopen");
+        return real(path, mode);
+    }
+
+    ssize_t read(int fd, void* buffer, size_t count)
+    {
+        static const auto real = RealtimeSafety::next<ssize_t (*)(int, void*, size_t)>("read");
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "read");
+        return real(fd, buffer, count);
+    }
+
+    ssize_t write(int fd, const void* buffer, size_t count)
+    {
+        static const auto real = RealtimeSafety::next<ssize_t (*)(int, const void*, size_t)>("write");
+        RealtimeSafety::check(RealtimeSafety::Kind::fileAccess, "write");
+        return real(fd, buffer, count);
+    }
+}
+#endif
+
+#if AMP_REPLACE_OPERATOR_NEW
+void* operator new(std::size_t size)
+{
+    RealtimeSafety::check(RealtimeSafety::Kind::allocation, "operator new");
+    if (void* pointer = std::malloc(size > 0 ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    RealtimeSafety::check(RealtimeSafety::Kind::allocation, "operator new[]");
+    if (void* pointer = std::malloc(size > 0 ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSafety::check(RealtimeSafety::Kind::allocation, "operator new");
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    RealtimeSafety::check(RealtimeSafety::Kind::allocation, "operator new[]");
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    if (pointer != nullptr)
+        RealtimeSafety::check(RealtimeSafety::Kind::deallocation, "operator delete");
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    if (pointer != nullptr)
+        RealtimeSafety::check(RealtimeSafety::Kind::deallocation, "operator delete[]");
+    std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { operator delete[](pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { operator delete(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { operator delete[](pointer); }
+#endif
+
+#else
+
+namespace RealtimeSafety
+{
+    void install() {}
+    void check(Kind, const char*) noexcept {}
+    int getNumViolations() { return 0; }
+    void clearViolations() {}
+    juce::String getReport(int) { return "Real-time checks are compiled out of this build (AMP_REALTIME_CHECKS=0)"; }
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+#include <JuceHeader.h>
+
+// Debug builds check that nothing on the audio thread allocates, takes a
+// lock or touches files; build with AMP_REALTIME_CHECKS=0 to drop the checks,
+// or =1 to keep them in a release build.
+// JUCE leaves JUCE_DEBUG undefined in release builds, so it can't be used as the value.
+#ifndef AMP_REALTIME_CHECKS
+ #if JUCE_DEBUG
+  #define AMP_REALTIME_CHECKS 1
+ #else
+  #define AMP_REALTIME_CHECKS 0
+ #endif
+#endif
+
+// Flags operations that can block on the audio thread. The callback opens a
+// ScopedAudioThread, and while it is open the interceptors in
+// RealtimeSafety.cpp record every heap allocation, heap free, mutex lock and
+// file access that thread makes, along with its stack. Which calls can be
+// intercepted depends on the platform:
+//  - Windows: EnterCriticalSection, the SRW locks, CreateFile, ReadFile and
+//    WriteFile, through the import tables of the executable and the C and C++
+//    runtimes; with the debug runtime also every malloc, realloc and free,
+//    through the CRT allocation hook, otherwise operator new and delete
+//  - Linux with glibc: the malloc family, pthread_mutex_lock, open, fopen, read and write
+//  - elsewhere, including macOS: operator new and delete only
+// Code that is known to block can call check() itself to be flagged everywhere,
+// as the IR loaders do. Recording never allocates or locks, so a violation
+// doesn't make the callback any later than the call that caused it.
+namespace RealtimeSafety
+{
+    enum class Kind { allocation, deallocation, lock, fileAccess };
+
+    constexpr bool enabled = AMP_REALTIME_CHECKS != 0;
+
+    // Once at startup, before any audio runs
+    void install();
+
+    // Records a violation if the calling thread is inside a ScopedAudioThread.
+    // what must be a string literal; it is kept by pointer.
+    void check(Kind kind, const char* what) noexcept;
+
+    int getNumViolations();
+    void clearViolations();
+
+    // Each distinct violation with its count and symbolised stack. Not for the audio thread.
+    juce::String getReport(int maxEntries = 20);
+
+    // Marks the current thread as real-time for the scope's lifetime
+    class ScopedAudioThread
+    {
+    public:
+       #if AMP_REALTIME_CHECKS
+        ScopedAudioThread();
+        ~ScopedAudioThread();
+       #else
+        ScopedAudioThread() {}
+       #endif
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedAudioThread)
+    };
+}
@@ -0,0 +1,91 @@
+#include "RealtimeSemaphore.h"
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #include <windows.h>
+ #include <climits>
+#elif JUCE_MAC
+ #include <dispatch/dispatch.h>
+#else
+ #include <semaphore.h>
+ #include <cerrno>
+ #include <ctime>
+#endif
+
+#if JUCE_WINDOWS
+struct RealtimeSemaphore::Pimpl
+{
+    Pimpl() : handle(CreateSemaphoreW(nullptr, 0, LONG_MAX, nullptr)) { jassert(handle != nullptr); }
+    ~Pimpl() { CloseHandle(handle); }
+
+    void signal() noexcept { ReleaseSemaphore(handle, 1, nullptr); }
+
+    bool wait(int timeoutMs)
+    {
+        return WaitForSingleObject(handle, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs) == WAIT_OBJECT_0;
+    }
+
+    HANDLE handle;
+};
+#elif JUCE_MAC
+struct RealtimeSemaphore::Pimpl
+{
+    Pimpl() : semaphore(dispatch_semaphore_create(0)) {}
+    ~Pimpl() { dispatch_release(semaphore); }
+
+    void signal() noexcept { dispatch_semaphore_signal(semaphore); }
+
+    bool wait(int timeoutMs)
+    {
+        const auto timeout = timeoutMs < 0 ? DISPATCH_TIME_FOREVER
+                                           : dispatch_time(DISPATCH_TIME_NOW, (int64_t)timeoutMs * (int64_t)NSEC_PER_MSEC);
+        return dispatch_semaphore_wait(semaphore, timeout) == 0;
+    }
+
+    dispatch_semaphore_t semaphore;
+};
+#else
+struct RealtimeSemaphore::Pimpl
+{
+    Pimpl() { sem_init(&semaphore, 0, 0); }
+    ~Pimpl() { sem_destroy(&semaphore); }
+
+    void signal() noexcept { sem_post(&semaphore); }
+
+    bool wait(int timeoutMs)
+    {
+        if (timeoutMs < 0)
+        {
+            while (sem_wait(&semaphore) != 0)
+                if (errno != EINTR)
+                    return false;
+            return true;
+        }
+
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeoutMs / 1000;
+        deadline.tv_nsec += (long)(timeoutMs % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (sem_timedwait(&semaphore, &deadline) != 0)
+            if (errno != EINTR)
+                return false;
+        return true;
+    }
+
+    sem_t semaphore;
+};
+#endif
+
+RealtimeSemaphore::RealtimeSemaphore() : pimpl(std::make_unique<Pimpl>()) {}
+RealtimeSemaphore::~RealtimeSemaphore() = default;
+
+void RealtimeSemaphore::signal() noexcept { pimpl->signal(); }
+bool RealtimeSemaphore::wait(int timeoutMs) { return pimpl->wait(timeoutMs); }
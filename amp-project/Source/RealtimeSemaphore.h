@@ -0,0 +1,27 @@
+#pragma once
+#include <JuceHeader.h>
+#include <memory>
+
+// A counting semaphore for waking worker threads from the audio thread.
+// juce::WaitableEvent::signal() locks a mutex, so a callback that signals one
+// can block behind whoever holds it; signal() here never takes a lock. It is
+// a futex-backed POSIX semaphore on Linux, a dispatch semaphore on macOS and
+// a kernel semaphore on Windows.
+class RealtimeSemaphore
+{
+public:
+    RealtimeSemaphore();
+    ~RealtimeSemaphore();
+
+    // Any thread, the audio thread included
+    void signal() noexcept;
+
+    // Returns false if timeoutMs passed first; -1 waits forever
+    bool wait(int timeoutMs = -1);
+
+private:
+    struct Pimpl;
+    std::unique_ptr<Pimpl> pimpl;
+
+    JUCE_DECLARE_NON_COPYABLE(RealtimeSemaphore)
+};
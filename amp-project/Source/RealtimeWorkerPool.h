@@ -0,0 +1,177 @@
+#pragma once
+#include <JuceHeader.h>
+#include <atomic>
+#include "RealtimeSemaphore.h"
+
+// A few pinned, high priority threads that take independent pieces of one
+// callback's work, e.g. the channels of a convolution, while the audio thread
+// does its share. Workers park as soon as there is nothing to claim, and the
+// audio thread wakes them with a semaphore post, which takes no lock. Tasks
+// are claimed from a shared counter, so anything a worker hasn't picked up in
+// time is simply run by the audio thread. If the audio thread still ends up
+// waiting too long on a worker, the pool runs everything serially for a while
+// before trying again.
+//
+// Nothing turns a pool on by default; use --stress --workers to check that
+// the wakeups cost less than the work they take off the audio thread.
+class RealtimeWorkerPool
+{
+public:
+    using TaskFn = void (*)(void* context, int taskIndex);
+
+    static constexpr int maxTasks = 255;
+
+    explicit RealtimeWorkerPool(int numWorkers)
+    {
+        for (int i = 0; i < numWorkers; ++i)
+            workers.add(new Worker(*this, i));
+
+        // Core 0 is left to the OS and the audio device's own thread
+        const int numCpus = juce::SystemStats::getNumCpus();
+        for (auto* worker : workers)
+        {
+            if (numCpus > 1 && numCpus <= 32)
+                worker->setAffinityMask(1u << (juce::uint32)(1 + worker->index % (numCpus - 1)));
+
+            if (!worker->startRealtimeThread(juce::Thread::RealtimeOptions{}.withPriority(8)))
+                worker->startThread(juce::Thread::Priority::highest);
+        }
+    }
+
+    ~RealtimeWorkerPool()
+    {
+        for (auto* worker : workers)
+            worker->signalThreadShouldExit();
+        for (int i = 0; i < workers.size(); ++i)
+            wakeUp.signal();
+        for (auto* worker : workers)
+            worker->stopThread(2000);
+    }
+
+    // Sets the wait that counts as a missed deadline from the callback period
+    void prepare(double sampleRate, int blockSize)
+    {
+        const double periodSeconds = blockSize / sampleRate;
+        lateTicks = juce::Time::secondsToHighResolutionTicks(0.25 * periodSeconds);
+        fallbackBatches = juce::jmax(1, (int)(sampleRate / blockSize));
+    }
+
+    int getNumWorkers() const { return workers.size(); }
+    int getNumLateBatches() const { return numLateBatches.load(); }
+    bool isRunningSerially() const { return serialBatchesLeft > 0; }
+
+    // Audio thread. Runs task(context, 0 .. numTasks - 1) and returns when all have finished.
+    void run(int numTasks, TaskFn task, void* context)
+    {
+        jassert(numTasks <= maxTasks);
+
+        if (workers.isEmpty() || numTasks <= 1 || serialBatchesLeft > 0)
+        {
+            serialBatchesLeft = juce::jmax(0, serialBatchesLeft.load() - 1);
+            for (int i = 0; i < numTasks; ++i)
+                task(context, i);
+            return;
+        }
+
+        currentTask = task;
+        currentContext = context;
+        remaining.store(numTasks, std::memory_order_relaxed);
+        generation = (generation + 1) & 0xffffff;
+        claim.store(((juce::uint64)generation << 40) | ((juce::uint64)numTasks << 32), std::memory_order_release);
+
+        // One post per parked worker. A worker that parks just after this misses the
+        // batch, and the audio thread runs its share.
+        for (int parked = numParked.load(); parked > 0; --parked)
+            wakeUp.signal();
+
+        while (runNextTask())
+        {
+        }
+
+        const auto waitStart = juce::Time::getHighResolutionTicks();
+        while (remaining.load(std::memory_order_acquire) > 0)
+            juce::Thread::yield();
+
+        if (juce::Time::getHighResolutionTicks() - waitStart > lateTicks)
+        {
+            ++numLateBatches;
+            serialBatchesLeft = fallbackBatches.load();
+        }
+    }
+
+    // Audio thread. Same as above for a callable taking the task index.
+    template <typename Fn>
+    void run(int numTasks, Fn& fn)
+    {
+        run(numTasks, [](void* context, int i) { (*static_cast<Fn*>(context))(i); }, &fn);
+    }
+
+private:
+    // The claim word packs the batch generation (24 bits), its task count (8 bits)
+    // and the next unclaimed index (32 bits). Claiming is a compare-and-swap on the
+    // whole word, so a worker still holding an old batch's word can never take a
+    // task from the next batch.
+    bool runNextTask()
+    {
+        auto word = claim.load(std::memory_order_acquire);
+        for (;;)
+        {
+            const auto index = (juce::uint32)(word & 0xffffffff);
+            const auto count = (juce::uint32)((word >> 32) & 0xff);
+            if (index >= count)
+                return false;
+
+            if (claim.compare_exchange_weak(word, word + 1, std::memory_order_acquire))
+            {
+                currentTask(currentContext, (int)index);
+                remaining.fetch_sub(1, std::memory_order_acq_rel);
+                return true;
+            }
+        }
+    }
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(RealtimeWorkerPool& poolToServe, int workerIndex)
+            : juce::Thread("Realtime worker " + juce::String(workerIndex)), pool(poolToServe), index(workerIndex)
+        {
+        }
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                while (pool.runNextTask())
+                {
+                }
+
+                // A post meant for a worker that has since woken leaves a count behind,
+                // which costs at most one extra pass through the loop
+                ++pool.numParked;
+                pool.wakeUp.wait(-1);
+                --pool.numParked;
+            }
+        }
+
+        RealtimeWorkerPool& pool;
+        const int index;
+    };
+
+    juce::OwnedArray<Worker> workers;
+    RealtimeSemaphore wakeUp;
+    std::atomic<int> numParked{ 0 };
+
+    std::atomic<juce::uint64> claim{ 0 };
+    std::atomic<int> remaining{ 0 };
+    TaskFn currentTask = nullptr;
+    void* currentContext = nullptr;
+    juce::uint32 generation = 0;
+
+    std::atomic<juce::int64> lateTicks{ 0 };
+    std::atomic<int> fallbackBatches{ 1 };
+    std::atomic<int> serialBatchesLeft{ 0 };
+    std::atomic<int> numLateBatches{ 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RealtimeWorkerPool)
+};
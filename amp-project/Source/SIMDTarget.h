@@ -0,0 +1,50 @@
+#pragma once
+
+// Which vector instruction set the build targets, picked from the compiler's
+// own flags. AVX builds also get AMP_SIMD_SSE, since every AVX CPU has SSE2.
+#if defined (__AVX__)
+ #include <immintrin.h>
+ #define AMP_SIMD_AVX 1
+#endif
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+ #include <emmintrin.h>
+ #define AMP_SIMD_SSE 1
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+ #include <arm_neon.h>
+ #define AMP_SIMD_NEON 1
+#endif
+
+#if AMP_SIMD_SSE || AMP_SIMD_NEON
+ #define AMP_SIMD_FLOAT4 1
+
+// Four float lanes, the width SSE2 and NEON have in common
+namespace Float4
+{
+   #if AMP_SIMD_SSE
+    using Type = __m128;
+    inline Type load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, Type v) { _mm_storeu_ps(p, v); }
+    inline Type broadcast(float v) { return _mm_set1_ps(v); }
+    inline Type set(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+    inline Type mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+    inline Type add(Type a, Type b) { return _mm_add_ps(a, b); }
+    inline Type sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+    inline Type min(Type a, Type b) { return _mm_min_ps(a, b); }
+    inline Type max(Type a, Type b) { return _mm_max_ps(a, b); }
+    inline Type abs(Type a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+   #else
+    using Type = float32x4_t;
+    inline Type load(const float* p) { return vld1q_f32(p); }
+    inline void store(float* p, Type v) { vst1q_f32(p, v); }
+    inline Type broadcast(float v) { return vdupq_n_f32(v); }
+    inline Type set(float a, float b, float c, float d) { const float lanes[4] = { a, b, c, d }; return vld1q_f32(lanes); }
+    inline Type mul(Type a, Type b) { return vmulq_f32(a, b); }
+    inline Type add(Type a, Type b) { return vaddq_f32(a, b); }
+    inline Type sub(Type a, Type b) { return vsubq_f32(a, b); }
+    inline Type min(Type a, Type b) { return vminq_f32(a, b); }
+    inline Type max(Type a, Type b) { return vmaxq_f32(a, b); }
+    inline Type abs(Type a) { return vabsq_f32(a); }
+   #endif
+}
+#endif
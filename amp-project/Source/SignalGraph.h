@@ -0,0 +1,465 @@
+#pragma once
+#include <JuceHeader.h>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <vector>
+
+// The order the engine runs its stages in, as a small graph. Profiles describe
+// it as text: stages joined by '>', with parallel branches in brackets whose
+// outputs are summed, e.g.
+//
+//     input > eq > pre > post > ir > output
+//     input > (pre > post | eq) > ir > output
+//
+// An empty branch passes its input through, so "(pre | )" blends the shaper
+// with the dry signal. Each stage can appear once, and the IR stage, which
+// turns a mono signal stereo, can't sit inside a branch. The shapers only
+// process one channel, so they have to come before it. Branches aren't
+// latency-aligned, so an oversampled shaper in one of them is a few samples late.
+//
+// A graph is compiled on a worker thread into a plan: a flat list of copy, add
+// and process steps over preallocated scratch buffers. The audio thread picks
+// up a new plan at the start of a block and hands the old one back to the
+// worker to delete, so changing the graph never allocates or locks in the
+// callback. The engine runs the default chain through its own hard-coded path
+// rather than the plan, so the default costs nothing extra.
+class SignalGraph : private juce::Thread
+{
+public:
+    static constexpr const char* defaultChain = "input > pre > eq > post > ir > output";
+
+    enum class Stage
+    {
+        inputGain,
+        preShaper,
+        eq,
+        postShaper,
+        ir,
+        outputGain,
+        mix     // Sums its inputs; where parallel branches join
+    };
+
+    struct Node
+    {
+        Stage stage;
+        std::vector<int> inputs;    // Earlier nodes, or -1 for the graph input
+    };
+
+    struct Description
+    {
+        std::vector<Node> nodes;    // In an order where every node comes after its inputs
+        juce::String text;
+
+        // Returns false and leaves result alone if the text isn't a valid graph
+        static bool parse(const juce::String& text, Description& result, juce::String& error)
+        {
+            Parser parser(text);
+            Description parsed;
+            parsed.text = text.trim();
+
+            const int output = parser.parseSequence(parsed, -1, 0);
+            if (parser.error.isEmpty() && !parser.atEnd())
+                parser.fail("unexpected '" + juce::String::charToString(parser.peek()) + "'");
+            if (parser.error.isNotEmpty())
+            {
+                error = parser.error;
+                return false;
+            }
+
+            // The last node must be the output; a graph ending on its input passes straight through
+            if (output != (int)parsed.nodes.size() - 1)
+                parsed.nodes.push_back({ Stage::mix, { output } });
+
+            result = std::move(parsed);
+            return true;
+        }
+
+        bool isDefaultChain() const
+        {
+            static const Stage order[] = { Stage::inputGain, Stage::preShaper, Stage::eq, Stage::postShaper, Stage::ir, Stage::outputGain };
+            if (nodes.size() != std::size(order))
+                return false;
+
+            for (size_t i = 0; i < nodes.size(); ++i)
+                if (nodes[i].stage != order[i] || nodes[i].inputs != std::vector<int>{ (int)i - 1 })
+                    return false;
+            return true;
+        }
+    };
+
+    struct Step
+    {
+        enum Op { copy, add, process, fanOut };
+
+        Op op;
+        Stage stage;
+        int source;     // Buffer slots; 0 is the block being processed
+        int target;
+        bool wide;      // All channels, rather than the mono front of the chain
+    };
+
+    // What the audio thread runs: the steps in order, and scratch for the
+    // branches. Built for one spec and only used with it.
+    struct Plan
+    {
+        // A slot's channels for this block: all of them, or just the first while the chain is mono
+        juce::dsp::AudioBlock<float> getBlock(int slot, juce::dsp::AudioBlock<float>& block, bool wide)
+        {
+            auto slotBlock = slot == 0 ? block
+                                       : juce::dsp::AudioBlock<float>(scratch)
+                                             .getSubsetChannelBlock((size_t)((slot - 1) * numChannels), (size_t)numChannels)
+                                             .getSubBlock(0, block.getNumSamples());
+            return wide ? slotBlock : slotBlock.getSingleChannelBlock(0);
+        }
+
+        std::vector<Step> steps;
+        juce::AudioBuffer<float> scratch;
+        int numChannels = 2;
+        bool isDefaultChain = false;
+    };
+
+    SignalGraph() : juce::Thread("Graph compiler")
+    {
+        juce::String error;
+        Description::parse(defaultChain, description, error);
+    }
+
+    ~SignalGraph() override
+    {
+        stopThread(2000);
+        for (auto* plan : { active, toRetire, incoming.load(), retired.load() })
+            delete plan;
+    }
+
+    // Not while processing. Recompiles the current graph for the new spec
+    // straight away; mono means the stages before the IR only carry channel 0.
+    void prepare(const juce::dsp::ProcessSpec& spec, bool mono)
+    {
+        Description current;
+        {
+            const juce::ScopedLock sl(requestLock);
+            currentSpec = spec;
+            monoFront = mono;
+            ++specGeneration;
+            current = description;
+        }
+
+        delete incoming.exchange(nullptr);
+        delete active;
+        delete toRetire;
+        toRetire = nullptr;
+        active = compile(current, spec, mono).release();
+
+        if (!isThreadRunning())
+            startThread();
+    }
+
+    // Control thread. The new graph is compiled in the background and takes
+    // over at the start of a block.
+    void setDescription(const Description& newDescription)
+    {
+        {
+            const juce::ScopedLock sl(requestLock);
+            description = newDescription;
+            pendingCompile = true;
+        }
+        notify();
+    }
+
+    juce::String getText() const
+    {
+        const juce::ScopedLock sl(requestLock);
+        return description.text;
+    }
+
+    // For offline use, while nothing is processing: waits for the last change
+    // and installs it directly.
+    bool finishPendingChange(int timeoutMs)
+    {
+        const auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32)timeoutMs;
+        for (;;)
+        {
+            {
+                const juce::ScopedLock sl(requestLock);
+                if (!pendingCompile && !compiling)
+                    break;
+            }
+
+            if (juce::Time::getMillisecondCounter() > deadline)
+                return false;
+            juce::Thread::sleep(1);
+        }
+
+        if (auto* plan = incoming.exchange(nullptr))
+        {
+            delete active;
+            active = plan;
+        }
+        return true;
+    }
+
+    // Audio thread. The plan to run this block; never null once prepared.
+    Plan& getPlan()
+    {
+        if (toRetire != nullptr && retired.load() == nullptr)
+        {
+            retired.store(toRetire);
+            toRetire = nullptr;
+        }
+
+        if (toRetire == nullptr)
+        {
+            if (auto* plan = incoming.exchange(nullptr))
+            {
+                toRetire = active;
+                active = plan;
+            }
+        }
+
+        return *active;
+    }
+
+private:
+    struct Parser
+    {
+        explicit Parser(const juce::String& textToParse) : text(textToParse) {}
+
+        // stage ('>' stage)*, fed from node input; returns the node it ends on
+        int parseSequence(Description& graph, int input, int depth)
+        {
+            skipSpaces();
+            if (atEnd() || peek() == '|' || peek() == ')')
+                return input;
+
+            int last = parseItem(graph, input, depth);
+            while (error.isEmpty() && accept('>'))
+                last = parseItem(graph, last, depth);
+            return last;
+        }
+
+        // A stage name, or '(' sequence ('|' sequence)* ')'
+        int parseItem(Description& graph, int input, int depth)
+        {
+            skipSpaces();
+            if (accept('('))
+            {
+                std::vector<int> ends;
+                do
+                {
+                    ends.push_back(parseSequence(graph, input, depth + 1));
+                } while (error.isEmpty() && accept('|'));
+
+                if (error.isEmpty() && !accept(')'))
+                    fail("missing ')'");
+                if (ends.size() == 1)
+                    return ends.front();
+
+                graph.nodes.push_back({ Stage::mix, ends });
+                return (int)graph.nodes.size() - 1;
+            }
+
+            juce::String name;
+            while (!atEnd() && juce::CharacterFunctions::isLetter(peek()))
+                name += juce::String::charToString(text[position++]);
+
+            Stage stage;
+            if (!findStage(name.toLowerCase(), stage))
+            {
+                fail(name.isEmpty() ? juce::String("expected a stage") : "unknown stage '" + name + "'");
+                return input;
+            }
+
+            for (const auto& node : graph.nodes)
+                if (node.stage == stage)
+                    fail("'" + name + "' appears twice");
+            if (stage == Stage::ir && depth > 0)
+                fail("'ir' can't be inside a parallel branch");
+
+            // Nodes are added in text order and 'ir' is never in a branch, so an earlier 'ir' is upstream
+            if (stage == Stage::preShaper || stage == Stage::postShaper)
+                for (const auto& node : graph.nodes)
+                    if (node.stage == Stage::ir)
+                        fail("'" + name + "' can't come after 'ir'");
+
+            graph.nodes.push_back({ stage, { input } });
+            return (int)graph.nodes.size() - 1;
+        }
+
+        static bool findStage(const juce::String& name, Stage& stage)
+        {
+            static const std::pair<const char*, Stage> names[] = {
+                { "input", Stage::inputGain }, { "pre", Stage::preShaper }, { "eq", Stage::eq },
+                { "post", Stage::postShaper }, { "ir", Stage::ir }, { "output", Stage::outputGain }
+            };
+
+            for (const auto& [stageName, value] : names)
+            {
+                if (name == stageName)
+                {
+                    stage = value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool accept(juce::juce_wchar c)
+        {
+            skipSpaces();
+            if (atEnd() || peek() != c)
+                return false;
+            ++position;
+            return true;
+        }
+
+        void skipSpaces()
+        {
+            while (!atEnd() && juce::CharacterFunctions::isWhitespace(peek()))
+                ++position;
+        }
+
+        void fail(const juce::String& message)
+        {
+            if (error.isEmpty())
+                error = message + " at position " + juce::String(position);
+        }
+
+        bool atEnd() const { return position >= text.length(); }
+        juce::juce_wchar peek() const { return text[position]; }
+
+        juce::String text;
+        int position = 0;
+        juce::String error;
+    };
+
+    // Not real-time. Each node works in place on its first input's buffer when
+    // nothing later still needs that value, otherwise on a copy in a free slot.
+    static std::unique_ptr<Plan> compile(const Description& graph, const juce::dsp::ProcessSpec& spec, bool mono)
+    {
+        auto plan = std::make_unique<Plan>();
+        plan->numChannels = (int)spec.numChannels;
+        plan->isDefaultChain = graph.isDefaultChain();
+
+        const int numNodes = (int)graph.nodes.size();
+
+        // Value v lives at index v + 1, so the graph input is index 0
+        std::vector<int> lastUse((size_t)numNodes + 1, -1), slotOf((size_t)numNodes + 1, 0);
+        std::vector<bool> isWide((size_t)numNodes + 1, !mono);
+        for (int i = 0; i < numNodes; ++i)
+            for (int input : graph.nodes[(size_t)i].inputs)
+                lastUse[(size_t)input + 1] = i;
+        lastUse[(size_t)numNodes] = numNodes;
+
+        std::vector<int> freeSlots;
+        int numSlots = 1;
+        auto takeSlot = [&freeSlots, &numSlots]
+        {
+            if (freeSlots.empty())
+                return numSlots++;
+            const int slot = freeSlots.back();
+            freeSlots.pop_back();
+            return slot;
+        };
+
+        for (int i = 0; i < numNodes; ++i)
+        {
+            const auto& node = graph.nodes[(size_t)i];
+            const int first = node.inputs.front() + 1;
+            const bool wide = isWide[(size_t)first];
+            const bool firstDiesHere = lastUse[(size_t)first] == i
+                                       && std::count(node.inputs.begin(), node.inputs.end(), node.inputs.front()) == 1;
+
+            int target = slotOf[(size_t)first];
+            if (!firstDiesHere)
+            {
+                target = takeSlot();
+                plan->steps.push_back({ Step::copy, node.stage, slotOf[(size_t)first], target, wide });
+            }
+
+            for (size_t k = 1; k < node.inputs.size(); ++k)
+                plan->steps.push_back({ Step::add, node.stage, slotOf[(size_t)node.inputs[k] + 1], target, wide });
+
+            // The IR stage reads the mono front and writes both channels
+            const bool outputWide = wide || node.stage == Stage::ir;
+            if (node.stage != Stage::mix)
+                plan->steps.push_back({ Step::process, node.stage, target, target, outputWide });
+
+            for (int input : node.inputs)
+            {
+                const int slot = slotOf[(size_t)input + 1];
+                if (lastUse[(size_t)input + 1] == i && slot != target
+                    && std::find(freeSlots.begin(), freeSlots.end(), slot) == freeSlots.end())
+                    freeSlots.push_back(slot);
+            }
+
+            slotOf[(size_t)i + 1] = target;
+            isWide[(size_t)i + 1] = outputWide;
+        }
+
+        const int output = slotOf[(size_t)numNodes];
+        if (output != 0)
+            plan->steps.push_back({ Step::copy, Stage::mix, output, 0, isWide[(size_t)numNodes] });
+        if (!isWide[(size_t)numNodes])
+            plan->steps.push_back({ Step::fanOut, Stage::mix, 0, 0, true });
+
+        plan->scratch.setSize(plan->numChannels * (numSlots - 1), (int)spec.maximumBlockSize, false, true, false);
+        return plan;
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            delete retired.exchange(nullptr);
+
+            Description job;
+            juce::dsp::ProcessSpec spec;
+            bool mono = true;
+            int generation = 0;
+            {
+                const juce::ScopedLock sl(requestLock);
+                compiling = pendingCompile;
+                pendingCompile = false;
+                job = description;
+                spec = currentSpec;
+                mono = monoFront;
+                generation = specGeneration;
+            }
+
+            if (!compiling)
+            {
+                wait(20);
+                continue;
+            }
+
+            auto plan = compile(job, spec, mono);
+            {
+                // A prepare() in the meantime has already compiled for the new spec
+                const juce::ScopedLock sl(requestLock);
+                if (generation == specGeneration)
+                    delete incoming.exchange(plan.release());
+                compiling = false;
+            }
+        }
+    }
+
+    // Worker side
+    juce::CriticalSection requestLock;
+    Description description;
+    bool pendingCompile = false;
+    bool compiling = false;
+    juce::dsp::ProcessSpec currentSpec{ 44100.0, 512, 2 };
+    bool monoFront = true;
+    int specGeneration = 0;
+
+    // Handoff, one slot each way
+    std::atomic<Plan*> incoming{ nullptr };
+    std::atomic<Plan*> retired{ nullptr };
+
+    // Audio side
+    Plan* active = nullptr;
+    Plan* toRetire = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SignalGraph)
+};
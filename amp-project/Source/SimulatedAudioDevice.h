@@ -0,0 +1,193 @@
+#pragma once
+#include <JuceHeader.h>
+
+// An AudioIODevice with no hardware behind it. A realtime thread calls the
+// device callback on a fixed grid of blockSize / sampleRate, exactly like a
+// driver would, and records when each callback started and how long it took.
+// Input channel 0 plays a looped test signal.
+class SimulatedAudioDevice : public juce::AudioIODevice,
+                             private juce::Thread
+{
+public:
+    struct CallbackTiming
+    {
+        double startMs;
+        double durationMs;
+    };
+
+    SimulatedAudioDevice(double sampleRate, int blockSize, int numCallbacks)
+        : juce::AudioIODevice("Simulated Device", "Simulated"),
+          juce::Thread("Simulated audio device"),
+          currentSampleRate(sampleRate),
+          currentBlockSize(blockSize),
+          callbacksToRun(numCallbacks)
+    {
+        timings.resize((size_t)numCallbacks);
+    }
+
+    ~SimulatedAudioDevice() override
+    {
+        close();
+    }
+
+    void setInputSignal(const juce::AudioBuffer<float>& signal)
+    {
+        jassert(!isThreadRunning());
+        inputSignal.makeCopyOf(signal);
+    }
+
+    // Blocks until every callback has run or the timeout expires
+    bool waitUntilFinished(int timeoutMs) { return finished.wait(timeoutMs); }
+
+    double getDeadlineMs() const { return 1000.0 * currentBlockSize / currentSampleRate; }
+    int getNumCallbacksRun() const { return numCallbacksRun.load(); }
+    int getNumLateWakeups() const { return numLateWakeups.load(); }
+    const std::vector<CallbackTiming>& getTimings() const { return timings; }
+
+    //==============================================================================
+    juce::StringArray getOutputChannelNames() override { return { "Left", "Right" }; }
+    juce::StringArray getInputChannelNames() override { return { "Input" }; }
+    juce::Array<double> getAvailableSampleRates() override { return { currentSampleRate }; }
+    juce::Array<int> getAvailableBufferSizes() override { return { currentBlockSize }; }
+    int getDefaultBufferSize() override { return currentBlockSize; }
+
+    juce::String open(const juce::BigInteger&, const juce::BigInteger&, double, int) override
+    {
+        inputBuffer.setSize(1, currentBlockSize);
+        outputBuffer.setSize(2, currentBlockSize);
+        deviceOpen = true;
+        return {};
+    }
+
+    void close() override
+    {
+        stop();
+        deviceOpen = false;
+    }
+
+    bool isOpen() override { return deviceOpen; }
+
+    void start(juce::AudioIODeviceCallback* newCallback) override
+    {
+        jassert(deviceOpen && newCallback != nullptr);
+        stop();
+
+        callback = newCallback;
+        callback->audioDeviceAboutToStart(this);
+
+        numCallbacksRun = 0;
+        numLateWakeups = 0;
+        finished.reset();
+        if (!startRealtimeThread(juce::Thread::RealtimeOptions{}.withApproximateAudioProcessingTime(currentBlockSize, currentSampleRate)))
+            startThread(juce::Thread::Priority::highest);
+    }
+
+    void stop() override
+    {
+        stopThread(2000);
+
+        if (callback != nullptr)
+        {
+            callback->audioDeviceStopped();
+            callback = nullptr;
+        }
+    }
+
+    bool isPlaying() override { return isThreadRunning(); }
+    juce::String getLastError() override { return {}; }
+    int getCurrentBufferSizeSamples() override { return currentBlockSize; }
+    double getCurrentSampleRate() override { return currentSampleRate; }
+    int getCurrentBitDepth() override { return 32; }
+    juce::BigInteger getActiveOutputChannels() const override { return 3; }
+    juce::BigInteger getActiveInputChannels() const override { return 1; }
+    int getOutputLatencyInSamples() override { return currentBlockSize; }
+    int getInputLatencyInSamples() override { return currentBlockSize; }
+
+    int getXRunCount() const noexcept override
+    {
+        int misses = 0;
+        for (int i = 0; i < numCallbacksRun.load(); ++i)
+            misses += timings[(size_t)i].durationMs > getDeadlineMs() ? 1 : 0;
+        return misses;
+    }
+
+private:
+    void run() override
+    {
+        const double periodMs = getDeadlineMs();
+        const float* inputs[] = { inputBuffer.getReadPointer(0) };
+        float* outputs[] = { outputBuffer.getWritePointer(0), outputBuffer.getWritePointer(1) };
+        const juce::AudioIODeviceCallbackContext context{};
+        int signalPosition = 0;
+
+        double nextStartMs = juce::Time::getMillisecondCounterHiRes();
+
+        for (int i = 0; i < callbacksToRun && !threadShouldExit(); ++i)
+        {
+            fillInput(signalPosition);
+
+            const double startMs = juce::Time::getMillisecondCounterHiRes();
+            const auto startTicks = juce::Time::getHighResolutionTicks();
+            callback->audioDeviceIOCallbackWithContext(inputs, 1, outputs, 2, currentBlockSize, context);
+            const auto endTicks = juce::Time::getHighResolutionTicks();
+
+            timings[(size_t)i] = { startMs, juce::Time::highResolutionTicksToSeconds(endTicks - startTicks) * 1000.0 };
+            numCallbacksRun = i + 1;
+
+            // Hold the grid like a driver would, sleeping while there is time and spinning for the last stretch.
+            // An overrun loses its slot and the grid restarts from now, as an xrun would.
+            nextStartMs += periodMs;
+            double now = juce::Time::getMillisecondCounterHiRes();
+            if (now > nextStartMs)
+            {
+                ++numLateWakeups;
+                nextStartMs = now;
+                continue;
+            }
+
+            while ((now = juce::Time::getMillisecondCounterHiRes()) < nextStartMs)
+            {
+                if (nextStartMs - now > 2.0)
+                    juce::Thread::sleep(1);
+                else
+                    juce::Thread::yield();
+            }
+        }
+
+        finished.signal();
+    }
+
+    void fillInput(int& signalPosition)
+    {
+        auto* input = inputBuffer.getWritePointer(0);
+        const int signalLength = inputSignal.getNumSamples();
+
+        if (signalLength == 0)
+        {
+            juce::FloatVectorOperations::clear(input, currentBlockSize);
+            return;
+        }
+
+        for (int i = 0; i < currentBlockSize; ++i)
+        {
+            input[i] = inputSignal.getSample(0, signalPosition);
+            signalPosition = (signalPosition + 1) % signalLength;
+        }
+    }
+
+    const double currentSampleRate;
+    const int currentBlockSize;
+    const int callbacksToRun;
+
+    juce::AudioIODeviceCallback* callback = nullptr;
+    juce::AudioBuffer<float> inputSignal;
+    juce::AudioBuffer<float> inputBuffer;
+    juce::AudioBuffer<float> outputBuffer;
+    std::vector<CallbackTiming> timings;
+    std::atomic<int> numCallbacksRun{ 0 };
+    std::atomic<int> numLateWakeups{ 0 };
+    juce::WaitableEvent finished{ true };
+    bool deviceOpen = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SimulatedAudioDevice)
+};
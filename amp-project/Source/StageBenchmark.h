@@ -0,0 +1,472 @@
+#pragma once
+#include <JuceHeader.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "AmpEngine.h"
+#include "Profiles.h"
+#include "OfflineRenderer.h"
+
+// Times each DSP stage on its own over a grid of block sizes and sample rates.
+// Results are CSV, one row per case, so runs from two releases can be diffed.
+class StageBenchmark
+{
+public:
+    struct Stats
+    {
+        int numBlocks = 0;
+        double meanNsPerSample = 0.0;
+        double minNsPerSample = 0.0;
+        double p50NsPerSample = 0.0;
+        double p90NsPerSample = 0.0;
+        double p99NsPerSample = 0.0;
+        double maxNsPerSample = 0.0;
+    };
+
+    static juce::ConsoleApplication::Command getCommand()
+    {
+        return { "--bench",
+                 "--bench [--output <file.csv>] [--stages waveshaper,tonestack,ir,convolution,engine] [--block-sizes 16,32,...] "
+                 "[--sample-rates 44100,48000,...] [--seconds 1.0] [--irs <folder>]",
+                 "Measures the per-sample cost of each DSP stage.",
+                 "Drives the waveshaper, tone stack and IR stages with a synthetic plucked-string signal, "
+                 "sweeping block sizes, sample rates and every bundled IR, the partitioned convolution against "
+                 "juce::dsp::Convolution on the longest reverb, then the whole engine in its "
+                 "stereo and mono layouts. Each case reports ns/sample "
+                 "as mean, min, p50, p90, p99 and max over all timed blocks, as CSV.",
+                 [](const juce::ArgumentList& args) { run(args); } };
+    }
+
+    static void run(const juce::ArgumentList& args)
+    {
+        juce::StringArray stages = parseList(args, "--stages", "waveshaper,tonestack,ir,convolution,engine");
+        juce::StringArray blockSizes = parseList(args, "--block-sizes", "16,32,64,128,256,512,1024,2048");
+        juce::StringArray sampleRates = parseList(args, "--sample-rates", "44100,48000,88200,96000,176400,192000");
+        const double seconds = args.containsOption("--seconds") ? juce::jmax(0.05, args.getValueForOption("--seconds").getDoubleValue()) : 1.0;
+        const bool needsIRs = stages.contains("ir") || stages.contains("convolution") || stages.contains("engine");
+        juce::File irDirectory = needsIRs ? OfflineRenderer::findIRDirectory(args) : juce::File();
+
+        juce::Array<juce::File> cabinetIRs, reverbIRs;
+        if (needsIRs)
+        {
+            cabinetIRs = irDirectory.getChildFile("Cabinet").findChildFiles(juce::File::findFiles, false, "*.wav");
+            reverbIRs = irDirectory.getChildFile("Reverb").findChildFiles(juce::File::findFiles, false, "*.wav");
+        }
+        if (needsIRs && cabinetIRs.isEmpty() && reverbIRs.isEmpty())
+            juce::ConsoleApplication::fail("No IRs found in " + irDirectory.getFullPathName());
+
+        std::unique_ptr<juce::FileOutputStream> file;
+        if (args.containsOption("--output"))
+        {
+            juce::File outputFile = args.getFileForOption("--output");
+            outputFile.deleteFile();
+            file = outputFile.createOutputStream();
+            if (file == nullptr)
+                juce::ConsoleApplication::fail("Could not write " + outputFile.getFullPathName());
+        }
+
+        auto emit = [&file](const juce::String& line)
+        {
+            if (file != nullptr)
+                *file << line << "\n";
+            else
+                std::cout << line << std::endl;
+        };
+
+        emit("# " + juce::String(ProjectInfo::projectName) + " " + ProjectInfo::versionString
+             + ", " + juce::SystemStats::getCpuModel() + ", " + juce::Time::getCurrentTime().toISO8601(true));
+        emit("stage,variant,sample_rate,block_size,blocks,mean_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns");
+
+        for (const auto& rateText : sampleRates)
+        {
+            const double sampleRate = rateText.getDoubleValue();
+            const juce::AudioBuffer<float> signal = makeGuitarSignal(sampleRate, seconds);
+
+            for (const auto& blockSizeText : blockSizes)
+            {
+                const int blockSize = blockSizeText.getIntValue();
+                const juce::dsp::ProcessSpec spec{ sampleRate, (juce::uint32)blockSize, 2 };
+
+                auto report = [&](const juce::String& stage, const juce::String& variant, const Stats& stats)
+                {
+                    emit(stage + "," + variant.quoted() + "," + juce::String(sampleRate, 0) + "," + juce::String(blockSize)
+                         + "," + juce::String(stats.numBlocks) + "," + juce::String(stats.meanNsPerSample, 3)
+                         + "," + juce::String(stats.minNsPerSample, 3) + "," + juce::String(stats.p50NsPerSample, 3)
+                         + "," + juce::String(stats.p90NsPerSample, 3) + "," + juce::String(stats.p99NsPerSample, 3)
+                         + "," + juce::String(stats.maxNsPerSample, 3));
+                };
+
+                if (file != nullptr)
+                    std::cout << "Benchmarking " << sampleRate << " Hz, " << blockSize << " samples" << std::endl;
+
+                if (stages.contains("waveshaper"))
+                    benchmarkWaveshaper(signal, spec, report);
+
+                if (stages.contains("tonestack"))
+                    benchmarkToneStack(signal, spec, report, emit);
+
+                if (stages.contains("ir"))
+                    benchmarkIRs(signal, spec, cabinetIRs, reverbIRs, report);
+
+                if (stages.contains("convolution"))
+                    benchmarkConvolution(signal, spec, findLongest(reverbIRs.isEmpty() ? cabinetIRs : reverbIRs), report, emit);
+
+                if (stages.contains("engine"))
+                    benchmarkEngine(signal, spec, cabinetIRs.isEmpty() ? juce::File() : cabinetIRs[0], findLongest(reverbIRs), report);
+            }
+        }
+    }
+
+    // Runs process over the signal block by block, timing every block on its own.
+    // The first pass over the signal is a warm-up and is not recorded.
+    template <typename ProcessFn>
+    static Stats measure(const juce::AudioBuffer<float>& signal, int blockSize, ProcessFn&& process)
+    {
+        const int numChannels = signal.getNumChannels();
+        const int numBlocks = signal.getNumSamples() / blockSize;
+        juce::AudioBuffer<float> work(numChannels, blockSize);
+        juce::dsp::AudioBlock<float> block(work);
+
+        std::vector<double> nsPerSample;
+        nsPerSample.reserve((size_t)numBlocks);
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i < numBlocks; ++i)
+            {
+                for (int channel = 0; channel < numChannels; ++channel)
+                    work.copyFrom(channel, 0, signal, channel, i * blockSize, blockSize);
+
+                const auto start = juce::Time::getHighResolutionTicks();
+                process(block);
+                const auto end = juce::Time::getHighResolutionTicks();
+
+                if (pass == 1)
+                    nsPerSample.push_back(juce::Time::highResolutionTicksToSeconds(end - start) * 1.0e9 / blockSize);
+            }
+        }
+
+        Stats stats;
+        if (nsPerSample.empty())
+            return stats;
+
+        std::sort(nsPerSample.begin(), nsPerSample.end());
+        auto percentile = [&nsPerSample](double p)
+        {
+            return nsPerSample[juce::jmin(nsPerSample.size() - 1, (size_t)(p * (double)nsPerSample.size()))];
+        };
+
+        double total = 0.0;
+        for (auto value : nsPerSample)
+            total += value;
+
+        stats.numBlocks = (int)nsPerSample.size();
+        stats.meanNsPerSample = total / (double)nsPerSample.size();
+        stats.minNsPerSample = nsPerSample.front();
+        stats.p50NsPerSample = percentile(0.50);
+        stats.p90NsPerSample = percentile(0.90);
+        stats.p99NsPerSample = percentile(0.99);
+        stats.maxNsPerSample = nsPerSample.back();
+        return stats;
+    }
+
+    // Karplus-Strong plucks cycling through the open strings of a guitar, one every quarter second
+    static juce::AudioBuffer<float> makeGuitarSignal(double sampleRate, double seconds)
+    {
+        static const float openStrings[] = { 82.41f, 110.0f, 146.83f, 196.0f, 246.94f, 329.63f };
+
+        const int numSamples = (int)(sampleRate * seconds);
+        const int pluckInterval = juce::jmax(1, (int)(sampleRate * 0.25));
+        juce::AudioBuffer<float> signal(2, numSamples);
+        juce::Random random(0x616d70);
+        std::vector<float> stringDelay;
+        size_t position = 0;
+
+        auto* data = signal.getWritePointer(0);
+        for (int i = 0; i < numSamples; ++i)
+        {
+            if (i % pluckInterval == 0)
+            {
+                const float frequency = openStrings[(i / pluckInterval) % 6];
+                stringDelay.assign((size_t)juce::jmax(2, (int)(sampleRate / frequency)), 0.0f);
+                for (auto& s : stringDelay)
+                    s = random.nextFloat() * 2.0f - 1.0f;
+                position = 0;
+            }
+
+            const size_t next = (position + 1) % stringDelay.size();
+            data[i] = 0.5f * stringDelay[position];
+            stringDelay[position] = 0.498f * (stringDelay[position] + stringDelay[next]);
+            position = next;
+        }
+
+        signal.copyFrom(1, 0, signal, 0, 0, numSamples);
+        return signal;
+    }
+
+private:
+    using ReportFn = std::function<void(const juce::String&, const juce::String&, const Stats&)>;
+
+    static juce::StringArray parseList(const juce::ArgumentList& args, const char* option, const char* defaultValue)
+    {
+        juce::String text = args.containsOption(option) ? args.getValueForOption(option) : juce::String(defaultValue);
+        juce::StringArray items = juce::StringArray::fromTokens(text, ",", "");
+        items.trim();
+        items.removeEmptyStrings();
+        return items;
+    }
+
+    static void benchmarkWaveshaper(const juce::AudioBuffer<float>& signal, const juce::dsp::ProcessSpec& spec, const ReportFn& report)
+    {
+        const ProfileManager::WaveshapeType shapes[] = { ProfileManager::SoftClip, ProfileManager::HardClip, ProfileManager::TanhClip };
+        const char* shapeNames[] = { "SoftClip", "HardClip", "TanhClip" };
+
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int factor = 1; factor <= WaveshaperProcessor::maxOversamplingFactor; factor *= 2)
+            {
+                for (int order = 0; order <= 2; ++order)
+                {
+                    WaveshaperProcessor waveshaper;
+                    waveshaper.prepare(spec);
+                    waveshaper.setPreEQFunction(ProfileManager::getWaveshapeFunction(shapes[i]));
+                    waveshaper.setPostEQFunction(ProfileManager::getWaveshapeFunction(shapes[i]));
+                    waveshaper.setOversamplingFactor(factor);
+                    waveshaper.setAntiderivativeOrder(order);
+
+                    juce::String variant = juce::String(shapeNames[i]) + " " + juce::String(factor) + "x";
+                    if (order > 0)
+                        variant << " ADAA" << order;
+
+                    report("waveshaper_pre", variant, measure(signal, (int)spec.maximumBlockSize,
+                        [&waveshaper](juce::dsp::AudioBlock<float>& block) { waveshaper.processPreEQ(block); }));
+
+                    report("waveshaper_post", variant, measure(signal, (int)spec.maximumBlockSize,
+                        [&waveshaper](juce::dsp::AudioBlock<float>& block) { waveshaper.processPostEQ(block); }));
+                }
+            }
+        }
+    }
+
+    // The fused cascade against the same three sections as juce::dsp::IIR filters,
+    // which take one pass over the block per section
+    static void benchmarkToneStack(const juce::AudioBuffer<float>& signal, const juce::dsp::ProcessSpec& spec,
+                                   const ReportFn& report, const std::function<void(const juce::String&)>& emit)
+    {
+        const int blockSize = (int)spec.maximumBlockSize;
+
+        ToneStack eq;
+        eq.prepare(spec);
+        report("tonestack", "fused", measure(signal, blockSize, [&eq](juce::dsp::AudioBlock<float>& block) { eq.process(block); }));
+
+        using Filter = juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>>;
+        const auto coefficients = eq.getCoefficients();
+        std::array<Filter, 3> filters;
+        for (size_t k = 0; k < filters.size(); ++k)
+        {
+            filters[k].state = coefficients[(int)k];
+            filters[k].prepare(spec);
+        }
+
+        auto processFilters = [&filters](juce::dsp::AudioBlock<float>& block)
+        {
+            juce::dsp::ProcessContextReplacing<float> context(block);
+            for (auto& filter : filters)
+                filter.process(context);
+        };
+        report("tonestack", "juce_iir", measure(signal, blockSize, processFilters));
+
+        // Same signal through both from a clean state
+        eq.prepare(spec);
+        for (auto& filter : filters)
+            filter.reset();
+
+        juce::AudioBuffer<float> fused(signal), reference(signal);
+        juce::dsp::AudioBlock<float> fusedBlock(fused), referenceBlock(reference);
+        for (int start = 0; start + blockSize <= signal.getNumSamples(); start += blockSize)
+        {
+            auto a = fusedBlock.getSubBlock((size_t)start, (size_t)blockSize);
+            auto b = referenceBlock.getSubBlock((size_t)start, (size_t)blockSize);
+            eq.process(a);
+            processFilters(b);
+        }
+
+        float maxDeviation = 0.0f;
+        for (int channel = 0; channel < signal.getNumChannels(); ++channel)
+            for (int i = 0; i < signal.getNumSamples(); ++i)
+                maxDeviation = juce::jmax(maxDeviation, std::abs(fused.getSample(channel, i) - reference.getSample(channel, i)));
+
+        emit("# tonestack at " + juce::String(spec.sampleRate, 0) + " Hz / " + juce::String(blockSize)
+             + ": max deviation of the fused cascade from juce::dsp::IIR " + juce::String(maxDeviation, 8));
+    }
+
+    static void benchmarkIRs(const juce::AudioBuffer<float>& signal, const juce::dsp::ProcessSpec& spec,
+                             const juce::Array<juce::File>& cabinetIRs, const juce::Array<juce::File>& reverbIRs,
+                             const ReportFn& report)
+    {
+        auto runCase = [&](const juce::String& stage, const juce::File& cabinetIR, const juce::File& reverbIR)
+        {
+            IRProcessor irProcessor;
+            irProcessor.prepare(spec);
+            irProcessor.setReverbGain(0.0f);
+            if (cabinetIR != juce::File())
+                irProcessor.loadCabinetIR(cabinetIR);
+            if (reverbIR != juce::File())
+                irProcessor.loadReverbIR(reverbIR);
+
+            if (!irProcessor.waitForPendingIRs(10000))
+            {
+                std::cerr << "Timed out loading IRs for " << stage << std::endl;
+                return;
+            }
+
+            juce::String variant = cabinetIR.getFileNameWithoutExtension();
+            if (reverbIR != juce::File())
+                variant << (variant.isEmpty() ? "" : " + ") << reverbIR.getFileNameWithoutExtension();
+
+            report(stage, variant.isEmpty() ? juce::String("none") : variant, measure(signal, (int)spec.maximumBlockSize,
+                [&irProcessor](juce::dsp::AudioBlock<float>& block) { irProcessor.process(block); }));
+        };
+
+        runCase("ir_bypassed", {}, {});
+
+        for (const auto& cabinetIR : cabinetIRs)
+            runCase("ir_cabinet", cabinetIR, {});
+
+        for (const auto& reverbIR : reverbIRs)
+            runCase("ir_reverb", {}, reverbIR);
+
+        // Pair every cabinet with the longest spring, the worst case a profile can ask for
+        const juce::File longestReverb = findLongest(reverbIRs);
+        if (longestReverb != juce::File())
+            for (const auto& cabinetIR : cabinetIRs)
+                runCase("ir_both", cabinetIR, longestReverb);
+    }
+
+    // The long reverb through PartitionedConvolution, whose tail runs on a worker,
+    // and through juce::dsp::Convolution, which does it all in the callback. The
+    // max column is the one that matters for dropouts.
+    static void benchmarkConvolution(const juce::AudioBuffer<float>& signal, const juce::dsp::ProcessSpec& spec,
+                                     const juce::File& irFile, const ReportFn& report,
+                                     const std::function<void(const juce::String&)>& emit)
+    {
+        auto entry = IRCache::prepareImpulseResponse(irFile, spec.sampleRate);
+        if (entry == nullptr)
+            return;
+
+        const int blockSize = (int)spec.maximumBlockSize;
+        const juce::String name = irFile.getFileNameWithoutExtension();
+
+        PartitionedConvolution partitioned;
+        partitioned.prepare(spec, entry->buffer);
+        report("convolution", "partitioned " + name, measure(signal, blockSize,
+            [&partitioned](juce::dsp::AudioBlock<float>& block) { partitioned.process(block); }));
+
+        // Same IR without the FIR head, for what zero latency costs
+        PartitionedConvolution delayed;
+        delayed.prepare(spec, entry->buffer, false);
+        report("convolution", "partitioned " + name + " +" + juce::String(delayed.getLatency()) + " latency", measure(signal, blockSize,
+            [&delayed](juce::dsp::AudioBlock<float>& block) { delayed.process(block); }));
+
+        juce::dsp::Convolution reference;
+        reference.prepare(spec);
+        reference.loadImpulseResponse(juce::AudioBuffer<float>(entry->buffer), entry->sampleRate,
+                                      juce::dsp::Convolution::Stereo::yes, juce::dsp::Convolution::Trim::no,
+                                      juce::dsp::Convolution::Normalise::no);
+
+        // It installs the IR on a later process call, fading in from a unit impulse
+        juce::AudioBuffer<float> scratch(signal.getNumChannels(), blockSize);
+        juce::dsp::AudioBlock<float> scratchBlock(scratch);
+        juce::dsp::ProcessContextReplacing<float> scratchContext(scratchBlock);
+        const auto deadline = juce::Time::getMillisecondCounter() + 10000;
+        while (reference.getCurrentIRSize() != entry->buffer.getNumSamples() && juce::Time::getMillisecondCounter() < deadline)
+        {
+            scratchBlock.clear();
+            reference.process(scratchContext);
+            juce::Thread::sleep(1);
+        }
+
+        for (int flushed = 0; flushed < (int)(spec.sampleRate * 0.1); flushed += blockSize)
+        {
+            scratchBlock.clear();
+            reference.process(scratchContext);
+        }
+
+        reference.reset();
+        report("convolution", "juce " + name, measure(signal, blockSize,
+            [&reference](juce::dsp::AudioBlock<float>& block) { reference.process(juce::dsp::ProcessContextReplacing<float>(block)); }));
+
+        // Same signal through both, and twice through the partitioned engine to show timing can't change its output
+        partitioned.reset();
+        reference.reset();
+        juce::AudioBuffer<float> first(signal), second(signal), expected(signal);
+        juce::dsp::AudioBlock<float> firstBlock(first), secondBlock(second), expectedBlock(expected);
+
+        PartitionedConvolution repeat;
+        repeat.prepare(spec, entry->buffer);
+        for (int start = 0; start + blockSize <= signal.getNumSamples(); start += blockSize)
+        {
+            auto a = firstBlock.getSubBlock((size_t)start, (size_t)blockSize);
+            auto b = secondBlock.getSubBlock((size_t)start, (size_t)blockSize);
+            auto c = expectedBlock.getSubBlock((size_t)start, (size_t)blockSize);
+            partitioned.process(a);
+            repeat.process(b);
+            reference.process(juce::dsp::ProcessContextReplacing<float>(c));
+            juce::Thread::yield();
+        }
+
+        float maxDeviation = 0.0f;
+        bool identical = true;
+        for (int channel = 0; channel < signal.getNumChannels(); ++channel)
+        {
+            for (int i = 0; i < signal.getNumSamples(); ++i)
+            {
+                maxDeviation = juce::jmax(maxDeviation, std::abs(first.getSample(channel, i) - expected.getSample(channel, i)));
+                identical = identical && first.getSample(channel, i) == second.getSample(channel, i);
+            }
+        }
+
+        emit("# convolution " + name + " at " + juce::String(spec.sampleRate, 0) + " Hz / " + juce::String(blockSize)
+             + ": max deviation from juce " + juce::String(maxDeviation, 8) + ", repeat run "
+             + (identical ? "bit-identical" : "DIFFERS") + ", tail jobs run in the callback "
+             + juce::String(partitioned.getNumMissedJobs() + repeat.getNumMissedJobs()) + ", tails muted by a stalled worker "
+             + juce::String(partitioned.getNumMutedTails() + repeat.getNumMutedTails()));
+    }
+
+    // The full chain at its default settings, processing both channels and only the amp's mono input
+    static void benchmarkEngine(const juce::AudioBuffer<float>& signal, const juce::dsp::ProcessSpec& spec,
+                                const juce::File& cabinetIR, const juce::File& reverbIR, const ReportFn& report)
+    {
+        for (const bool mono : { false, true })
+        {
+            AmpEngine engine;
+            engine.setMonoProcessing(mono);
+            engine.prepare(spec);
+
+            auto& irProcessor = engine.getIRProcessor();
+            if (cabinetIR != juce::File())
+                irProcessor.loadCabinetIR(cabinetIR);
+            if (reverbIR != juce::File())
+                irProcessor.loadReverbIR(reverbIR);
+
+            if (!irProcessor.waitForPendingIRs(10000))
+            {
+                std::cerr << "Timed out loading IRs for engine" << std::endl;
+                return;
+            }
+
+            report("engine", mono ? "mono" : "stereo", measure(signal, (int)spec.maximumBlockSize,
+                [&engine](juce::dsp::AudioBlock<float>& block) { engine.process(block); }));
+        }
+    }
+
+    static juce::File findLongest(const juce::Array<juce::File>& files)
+    {
+        juce::File longest;
+        for (const auto& file : files)
+            if (longest == juce::File() || file.getSize() > longest.getSize())
+                longest = file;
+
+        return longest;
+    }
+};
@@ -0,0 +1,167 @@
+#pragma once
+#include <JuceHeader.h>
+#include <array>
+#include <atomic>
+
+// Build with AMP_PROFILING=0 to strip the instrumentation. The scopes below
+// are then empty structs and the audio thread pays nothing for them.
+#ifndef AMP_PROFILING
+ #define AMP_PROFILING 1
+#endif
+
+// Where each audio callback's time goes, stage by stage. The audio thread
+// reads the high resolution clock around the callback and around every
+// stage, then pushes one Frame per callback into a lock-free FIFO for the
+// diagnostics view to drain. If nobody drains it, frames are dropped.
+class StageProfiler
+{
+public:
+    static constexpr bool enabled = AMP_PROFILING != 0;
+
+    // The engine stages, in SignalGraph::Stage order, then the parts of the IR
+    // stage timed on their own. The ir slot keeps only what is left of it.
+    enum Slot { input, pre, eq, post, ir, output, cabinet, reverb, numSlots };
+
+    static const char* getSlotName(int slot)
+    {
+        static const char* const names[] = { "input", "pre", "eq", "post", "ir", "output", "cabinet", "reverb" };
+        return names[slot];
+    }
+
+    struct Frame
+    {
+        juce::int64 startTicks = 0;
+        juce::int64 callbackTicks = 0;
+        std::array<juce::int64, numSlots> stageTicks{};
+        int numSamples = 0;
+    };
+
+    void prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+    }
+
+    double getSampleRate() const { return sampleRate.load(); }
+
+    // Audio thread, around the whole callback
+    class CallbackScope
+    {
+    public:
+       #if AMP_PROFILING
+        CallbackScope(StageProfiler& owner, int numSamples) : profiler(owner)
+        {
+            profiler.current = Frame{};
+            profiler.current.numSamples = numSamples;
+            profiler.current.startTicks = juce::Time::getHighResolutionTicks();
+        }
+
+        ~CallbackScope()
+        {
+            auto& frame = profiler.current;
+            frame.callbackTicks = juce::Time::getHighResolutionTicks() - frame.startTicks;
+            profiler.push(frame);
+        }
+
+    private:
+        StageProfiler& profiler;
+       #else
+        CallbackScope(StageProfiler&, int) {}
+       #endif
+    };
+
+    // Audio thread, around one stage inside a CallbackScope
+    class StageScope
+    {
+    public:
+       #if AMP_PROFILING
+        StageScope(StageProfiler& owner, int stageSlot)
+            : profiler(owner), slot(stageSlot), start(juce::Time::getHighResolutionTicks())
+        {
+        }
+
+        ~StageScope()
+        {
+            profiler.current.stageTicks[(size_t)slot] += juce::Time::getHighResolutionTicks() - start;
+        }
+
+    private:
+        StageProfiler& profiler;
+        int slot;
+        juce::int64 start;
+       #else
+        StageScope(StageProfiler&, int) {}
+       #endif
+    };
+
+    // Audio thread, around part of a stage inside that stage's StageScope. The
+    // time moves from the stage's slot to the part's, so nothing is counted twice.
+    // A null profiler times nothing.
+    class PartScope
+    {
+    public:
+       #if AMP_PROFILING
+        PartScope(StageProfiler* owner, int partSlot, int stageSlot)
+            : profiler(owner), slot(partSlot), parent(stageSlot), start(owner != nullptr ? juce::Time::getHighResolutionTicks() : 0)
+        {
+        }
+
+        ~PartScope()
+        {
+            if (profiler == nullptr)
+                return;
+
+            const auto ticks = juce::Time::getHighResolutionTicks() - start;
+            profiler->current.stageTicks[(size_t)slot] += ticks;
+            profiler->current.stageTicks[(size_t)parent] -= ticks;
+        }
+
+    private:
+        StageProfiler* profiler;
+        int slot, parent;
+        juce::int64 start;
+       #else
+        PartScope(StageProfiler*, int, int) {}
+       #endif
+    };
+
+    // The reading thread (one at a time). Moves up to maxFrames of the oldest
+    // frames into frames and returns how many there were.
+    int pop(Frame* frames, int maxFrames)
+    {
+       #if AMP_PROFILING
+        const auto scope = fifo.read(maxFrames);
+        std::copy(buffer.begin() + scope.startIndex1, buffer.begin() + scope.startIndex1 + scope.blockSize1, frames);
+        std::copy(buffer.begin() + scope.startIndex2, buffer.begin() + scope.startIndex2 + scope.blockSize2, frames + scope.blockSize1);
+        return scope.blockSize1 + scope.blockSize2;
+       #else
+        juce::ignoreUnused(frames, maxFrames);
+        return 0;
+       #endif
+    }
+
+    // Frames lost to a full FIFO since the last call
+    int takeNumDropped() { return numDropped.exchange(0); }
+
+private:
+   #if AMP_PROFILING
+    static constexpr int capacity = 1024;
+
+    void push(const Frame& frame)
+    {
+        const auto scope = fifo.write(1);
+        if (scope.blockSize1 > 0)
+            buffer[(size_t)scope.startIndex1] = frame;
+        else if (scope.blockSize2 > 0)
+            buffer[(size_t)scope.startIndex2] = frame;
+        else
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Frame current;      // Audio thread
+    juce::AbstractFifo fifo{ capacity };
+    std::array<Frame, capacity> buffer;
+   #endif
+
+    std::atomic<double> sampleRate{ 44100.0 };
+    std::atomic<int> numDropped{ 0 };
+};
@@ -0,0 +1,315 @@
+#pragma once
+#include <JuceHeader.h>
+#include <algorithm>
+#include <iostream>
+#include "AmpEngine.h"
+#include "Presets.h"
+#include "Profiles.h"
+#include "SimulatedAudioDevice.h"
+#include "StageBenchmark.h"
+#include "OfflineRenderer.h"
+#include "RealtimeSafety.h"
+
+// Runs the amp engine at exact device cadence on a SimulatedAudioDevice while a
+// second thread does what the UI does during a gig: flips presets, drags knobs
+// and switches IRs. Reports the worst callbacks against their deadline.
+class StressHarness
+{
+public:
+    static juce::ConsoleApplication::Command getCommand()
+    {
+        return { "--stress",
+                 "--stress [--seconds 30] [--sample-rate 48000] [--block-size 128] [--irs <folder>] "
+                 "[--internal-block-size 0] [--workers 0] [--no-automation] [--csv <file>] [--fail-on-miss] [--fail-on-rt-violation]",
+                 "Checks the audio callback's worst case against its deadline.",
+                 "Drives the engine through a simulated audio device at blockSize / sampleRate cadence "
+                 "while another thread changes presets, knobs and IRs. Reports mean, p99, p99.9 and max "
+                 "callback time and the number of deadline misses. --internal-block-size sets the sub-block size "
+                 "the engine's stages run at, rounded up to a power of two; 0 follows the device. --workers runs the convolution channels on "
+                 "that many real-time worker threads. --fail-on-miss exits with an error "
+                 "if any callback missed its deadline. Builds with real-time checks also report, with its stack, "
+                 "each allocation on the audio thread, and on Windows and Linux each lock and file access; "
+                 "on macOS only operator new and delete are seen. --fail-on-rt-violation exits with "
+                 "an error if there were any.",
+                 [](const juce::ArgumentList& args) { run(args); } };
+    }
+
+    static void run(const juce::ArgumentList& args)
+    {
+        const double seconds = args.containsOption("--seconds") ? juce::jmax(1.0, args.getValueForOption("--seconds").getDoubleValue()) : 30.0;
+        const double sampleRate = args.containsOption("--sample-rate") ? args.getValueForOption("--sample-rate").getDoubleValue() : 48000.0;
+        const int blockSize = args.containsOption("--block-size") ? juce::jlimit(16, 8192, args.getValueForOption("--block-size").getIntValue()) : 128;
+        juce::File irDirectory = OfflineRenderer::findIRDirectory(args);
+
+        const int numCallbacks = (int)(seconds * sampleRate / blockSize);
+        SimulatedAudioDevice device(sampleRate, blockSize, numCallbacks);
+        device.setInputSignal(StageBenchmark::makeGuitarSignal(sampleRate, 4.0));
+        device.open(1, 3, sampleRate, blockSize);
+
+        // IR switches come from memory, as they do in the app once its cache has warmed up
+        const auto cabinetIRs = irDirectory.getChildFile("Cabinet").findChildFiles(juce::File::findFiles, false, "*.wav");
+        const auto reverbIRs = irDirectory.getChildFile("Reverb").findChildFiles(juce::File::findFiles, false, "*.wav");
+        if (cabinetIRs.isEmpty() && reverbIRs.isEmpty())
+            juce::ConsoleApplication::fail("No IRs found in " + irDirectory.getFullPathName());
+        IRCache irCache;
+
+        std::unique_ptr<RealtimeWorkerPool> workerPool;
+        const int numWorkers = args.containsOption("--workers") ? juce::jlimit(0, 16, args.getValueForOption("--workers").getIntValue()) : 0;
+        if (numWorkers > 0)
+            workerPool = std::make_unique<RealtimeWorkerPool>(numWorkers);
+
+        EngineSource source;
+        source.swapFlags.assign((size_t)numCallbacks, 0);
+        if (args.containsOption("--internal-block-size"))
+            source.engine.setInternalBlockSize(juce::jmax(0, args.getValueForOption("--internal-block-size").getIntValue()));
+        source.engine.getIRProcessor().setWorkerPool(workerPool.get());
+        source.engine.getIRProcessor().setCache(&irCache);
+        irCache.preload(cabinetIRs, sampleRate, source.engine.getIRProcessor().getCabinetPreprocessing());
+        irCache.preload(reverbIRs, sampleRate, source.engine.getIRProcessor().getReverbPreprocessing());
+        applyPreset(source.engine, presets[0]);
+
+        juce::AudioSourcePlayer player;
+        player.setSource(&source);
+
+        ControlThread control(source.engine, cabinetIRs, reverbIRs);
+
+        std::cout << "Stress: " << sampleRate << " Hz, " << blockSize << " samples, deadline "
+                  << juce::String(device.getDeadlineMs(), 3) << " ms, " << numCallbacks << " callbacks"
+                  << (args.containsOption("--no-automation") ? "" : ", with automation")
+                  << (numWorkers > 0 ? ", " + juce::String(numWorkers) + " worker(s)" : juce::String()) << std::endl;
+
+        RealtimeSafety::clearViolations();
+        device.start(&player);
+        if (!args.containsOption("--no-automation"))
+            control.startThread();
+
+        device.waitUntilFinished(-1);
+        control.stopThread(5000);
+        device.stop();
+        player.setSource(nullptr);
+
+        const auto& timings = device.getTimings();
+        const int numRun = device.getNumCallbacksRun();
+        std::vector<double> durations;
+        durations.reserve((size_t)numRun);
+        for (int i = 0; i < numRun; ++i)
+            durations.push_back(timings[(size_t)i].durationMs);
+
+        if (args.containsOption("--csv"))
+            writeCsv(args.getFileForOption("--csv"), timings, source.swapFlags, numRun, device.getDeadlineMs());
+
+        if (durations.empty())
+            juce::ConsoleApplication::fail("No callbacks ran");
+
+        // IR swaps run two engines side by side for the length of the crossfade; show what that costs
+        double swapTotal = 0.0, swapMax = 0.0, steadyTotal = 0.0;
+        int numSwapCallbacks = 0;
+        for (int i = 0; i < numRun; ++i)
+        {
+            if (source.swapFlags[(size_t)i] != 0)
+            {
+                swapTotal += durations[(size_t)i];
+                swapMax = juce::jmax(swapMax, durations[(size_t)i]);
+                ++numSwapCallbacks;
+            }
+            else
+            {
+                steadyTotal += durations[(size_t)i];
+            }
+        }
+
+        std::sort(durations.begin(), durations.end());
+        auto percentile = [&durations](double p)
+        {
+            return durations[juce::jmin(durations.size() - 1, (size_t)(p * (double)durations.size()))];
+        };
+
+        double total = 0.0;
+        for (auto d : durations)
+            total += d;
+
+        const double deadlineMs = device.getDeadlineMs();
+        const int misses = device.getXRunCount();
+        auto describe = [deadlineMs](double ms)
+        {
+            return juce::String(ms, 3) + " ms (" + juce::String(100.0 * ms / deadlineMs, 1) + "%)";
+        };
+
+        std::cout << "  mean   " << describe(total / (double)durations.size()) << std::endl
+                  << "  p99    " << describe(percentile(0.99)) << std::endl
+                  << "  p99.9  " << describe(percentile(0.999)) << std::endl
+                  << "  max    " << describe(durations.back()) << std::endl
+                  << "  deadline misses: " << misses << ", late wakeups: " << device.getNumLateWakeups()
+                  << ", control actions: " << control.getNumActions() << std::endl;
+
+        if (workerPool != nullptr)
+            std::cout << "  worker batches that came in late and fell back to serial: " << workerPool->getNumLateBatches() << std::endl;
+
+        if (numSwapCallbacks > 0)
+            std::cout << "  IR swaps: " << numSwapCallbacks << " crossfading callbacks, mean "
+                      << describe(swapTotal / numSwapCallbacks) << ", max " << describe(swapMax)
+                      << ", against a steady mean of " << describe(steadyTotal / juce::jmax(1, numRun - numSwapCallbacks)) << std::endl;
+
+        const int violations = RealtimeSafety::getNumViolations();
+        if (!RealtimeSafety::enabled)
+            std::cout << "  real-time checks are compiled out of this build (AMP_REALTIME_CHECKS=0)" << std::endl;
+        else if (violations > 0)
+            std::cout << std::endl << RealtimeSafety::getReport() << std::endl;
+        else
+            std::cout << "  real-time violations: 0" << std::endl;
+
+        if (misses > 0 && args.containsOption("--fail-on-miss"))
+            juce::ConsoleApplication::fail(juce::String(misses) + " callback(s) missed the deadline");
+        if (violations > 0 && args.containsOption("--fail-on-rt-violation"))
+            juce::ConsoleApplication::fail(juce::String(violations) + " real-time violation(s) on the audio thread");
+    }
+
+    // The preset half of MainComponent::setPreset, without the sliders
+    static void applyPreset(AmpEngine& engine, const Preset& p)
+    {
+        auto& eq = engine.getToneStack();
+        eq.setlowFrequency(p.low.frequency);
+        eq.setlowQ(p.low.default);
+        eq.setmidFrequency(p.mid.frequency);
+        eq.setmidQ(p.mid.q);
+        eq.updatemidGain(p.mid.default);
+        eq.sethighFrequency(p.high.frequency);
+        eq.sethighQ(p.high.q);
+        eq.updatehighGain(p.high.default);
+
+        engine.getWaveshaper().setPreEQFunction(p.preEQFunction);
+        engine.getWaveshaper().setPostEQFunction(p.postEQFunction);
+        engine.setInputGain(p.inputGainDefault);
+        engine.setOutputGain(p.outputGainDefault);
+    }
+
+private:
+    // What MainComponent::getNextAudioBlock does outside of tuner mode, metering included
+    struct EngineSource : public juce::AudioSource
+    {
+        void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
+        {
+            engine.prepare({ sampleRate, (juce::uint32)samplesPerBlockExpected, 2 });
+        }
+
+        void releaseResources() override {}
+
+        void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+        {
+            const RealtimeSafety::ScopedAudioThread realtime;
+            auto* buffer = bufferToFill.buffer;
+            auto block = juce::dsp::AudioBlock<float>(*buffer).getSubBlock((size_t)bufferToFill.startSample, (size_t)bufferToFill.numSamples);
+
+            engine.process(block);
+            engine.clampOutput(block);
+
+            if (callbackIndex < swapFlags.size())
+                swapFlags[callbackIndex++] = engine.getIRProcessor().isSwappingIRs() ? 1 : 0;
+        }
+
+        AmpEngine engine;
+        std::vector<char> swapFlags;    // One per callback, sized before the device starts
+        size_t callbackIndex = 0;
+    };
+
+    // Plays the part of the message thread: knob drags and meter reads at display
+    // rate, an IR switch every two seconds and a preset flip every five.
+    class ControlThread : public juce::Thread
+    {
+    public:
+        ControlThread(AmpEngine& engineToControl, juce::Array<juce::File> cabinets, juce::Array<juce::File> reverbs)
+            : juce::Thread("Stress control"), engine(engineToControl),
+              cabinetIRs(std::move(cabinets)), reverbIRs(std::move(reverbs))
+        {
+        }
+
+        int getNumActions() const { return numActions.load(); }
+
+        void run() override
+        {
+            int presetIndex = 0;
+            int tick = 0;
+
+            while (!threadShouldExit())
+            {
+                const Preset& p = presets[presetIndex];
+                const float position = 0.5f + 0.5f * std::sin((float)tick * 0.05f);
+
+                engine.setInputGain(juce::jmap(position, p.inputGainMin, p.inputGainMax));
+                engine.setOutputGain(juce::jmap(1.0f - position, p.outputGainMin, p.outputGainMax));
+                engine.getToneStack().setlowQ(juce::jmap(position, p.low.min, p.low.max));
+                engine.getToneStack().updatemidGain(juce::jmap(position, p.mid.min, p.mid.max));
+                engine.getToneStack().updatehighGain(juce::jmap(1.0f - position, p.high.min, p.high.max));
+                engine.getIRProcessor().setReverbGain(juce::jmap(position, -12.0f, 12.0f));
+                engine.getIRProcessor().setCabinetMix(position);
+                engine.getIRProcessor().setCabinetGain(juce::jmap(1.0f - position, -6.0f, 6.0f));
+                numActions += 8;
+
+                engine.getInputMeter().read();
+                engine.getOutputMeter().read();
+
+                if (tick % 120 == 0)
+                    switchIRs(tick / 120);
+
+                if (tick % 300 == 299)
+                {
+                    presetIndex = (presetIndex + 1) % 3;
+                    applyPreset(engine, presets[presetIndex]);
+                    ++numActions;
+                }
+
+                ++tick;
+                wait(16);
+            }
+        }
+
+    private:
+        void switchIRs(int step)
+        {
+            auto& irProcessor = engine.getIRProcessor();
+
+            if (!cabinetIRs.isEmpty())
+            {
+                const int index = step % (cabinetIRs.size() + 1);
+                if (index == cabinetIRs.size())
+                    irProcessor.resetCabinetIR();
+                else
+                    irProcessor.loadCabinetIR(cabinetIRs[index]);
+            }
+
+            if (!reverbIRs.isEmpty())
+            {
+                const int index = step % (reverbIRs.size() + 1);
+                if (index == reverbIRs.size())
+                    irProcessor.resetReverbIR();
+                else
+                    irProcessor.loadReverbIR(reverbIRs[index]);
+            }
+
+            numActions += 2;
+        }
+
+        AmpEngine& engine;
+        juce::Array<juce::File> cabinetIRs;
+        juce::Array<juce::File> reverbIRs;
+        std::atomic<int> numActions{ 0 };
+    };
+
+    static void writeCsv(const juce::File& file, const std::vector<SimulatedAudioDevice::CallbackTiming>& timings,
+                         const std::vector<char>& swapFlags, int numRun, double deadlineMs)
+    {
+        file.deleteFile();
+        auto stream = file.createOutputStream();
+        if (stream == nullptr)
+            juce::ConsoleApplication::fail("Could not write " + file.getFullPathName());
+
+        *stream << "callback,start_ms,duration_ms,deadline_ms,ir_swap\n";
+        const double firstStart = numRun > 0 ? timings[0].startMs : 0.0;
+        for (int i = 0; i < numRun; ++i)
+        {
+            *stream << juce::String(i) << "," << juce::String(timings[(size_t)i].startMs - firstStart, 4) << ","
+                    << juce::String(timings[(size_t)i].durationMs, 4) << "," << juce::String(deadlineMs, 4) << ","
+                    << (int)swapFlags[(size_t)i] << "\n";
+        }
+    }
+};
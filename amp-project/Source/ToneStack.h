@@ -1,5 +1,7 @@
 #pragma once
 #include <JuceHeader.h>
+#include "BiquadCascade.h"
+#include "ParameterHandoff.h"
 
 class ToneStack
 {
@@ -10,19 +12,51 @@ public:
     {
         sampleRate = spec.sampleRate;
 
-        low.prepare(spec);
-        mid.prepare(spec);
-        high.prepare(spec);
+        jassert(spec.numChannels <= (juce::uint32)Cascade::maxChannels);
+        cascade.reset();
+        rampLength = juce::jmax(1, juce::roundToInt(sampleRate * coefficientRampSeconds));
+        rampRemaining = 0;
+        jumpToNextUpdate = true;
 
         updateFilters();
     }
 
+    // High-pass, peak and high-shelf in a single pass over the block
     void process(juce::dsp::AudioBlock<float>& block)
     {
-        auto context = juce::dsp::ProcessContextReplacing<float>(block);
-        low.process(context);
-        mid.process(context);
-        high.process(context);
+        if (handoff.pull())
+            startRamp(handoff.current());
+
+        float* channels[Cascade::maxChannels];
+        const int numChannels = (int)juce::jmin(block.getNumChannels(), (size_t)Cascade::maxChannels);
+        const int numSamples = (int)block.getNumSamples();
+        int position = 0;
+
+        // While a change ramps in, the coefficients move every few samples
+        while (rampRemaining > 0 && position < numSamples)
+        {
+            const int chunk = juce::jmin(coefficientRampStep, rampRemaining, numSamples - position);
+            rampRemaining -= chunk;
+
+            const float progress = 1.0f - (float)rampRemaining / (float)rampLength;
+            for (size_t k = 0; k < applied.size(); ++k)
+            {
+                applied[k] = rampRemaining > 0 ? interpolate(rampStart[k], rampTarget[k], progress) : rampTarget[k];
+                cascade.setSection((int)k, applied[k]);
+            }
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                channels[channel] = block.getChannelPointer((size_t)channel) + position;
+            cascade.process(channels, numChannels, (size_t)chunk);
+            position += chunk;
+        }
+
+        if (position < numSamples)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                channels[channel] = block.getChannelPointer((size_t)channel) + position;
+            cascade.process(channels, numChannels, (size_t)(numSamples - position));
+        }
     }
 
     void setlowFrequency(float frequency) { lowFrequency = frequency; updateLow(); }
@@ -36,7 +70,51 @@ public:
     void sethighQ(float q) { highQ = q; updateHigh(); }
     void updatehighGain(float gainDb) { highGain = juce::Decibels::decibelsToGain(gainDb); updateHigh(); }
 
+    // Low, mid and high as JUCE coefficients, which the benchmark checks the cascade
+    // against. Allocates, so not for the audio thread.
+    juce::Array<juce::dsp::IIR::Coefficients<float>::Ptr> getCoefficients() const
+    {
+        juce::Array<juce::dsp::IIR::Coefficients<float>::Ptr> coefficients;
+        for (const auto& section : designed)
+            coefficients.add(new juce::dsp::IIR::Coefficients<float>(section.b0, section.b1, section.b2, 1.0f, section.a1, section.a2));
+        return coefficients;
+    }
+
 private:
+    using Cascade = BiquadCascade<3>;
+    using Sections = std::array<Cascade::Section, 3>;
+
+    static constexpr double coefficientRampSeconds = 0.02;
+    static constexpr int coefficientRampStep = 16;
+
+    // Audio thread. The first update after prepare is applied as is; later ones
+    // glide from whatever the filters are doing now, mid-ramp or not.
+    void startRamp(const Sections& target)
+    {
+        if (jumpToNextUpdate)
+        {
+            applied = target;
+            for (size_t k = 0; k < applied.size(); ++k)
+                cascade.setSection((int)k, applied[k]);
+            jumpToNextUpdate = false;
+            return;
+        }
+
+        rampStart = applied;
+        rampTarget = target;
+        rampRemaining = rampLength;
+    }
+
+    // Stable biquads form a convex set in (a1, a2), so every point on the way is stable too
+    static Cascade::Section interpolate(const Cascade::Section& from, const Cascade::Section& to, float amount)
+    {
+        return { from.b0 + (to.b0 - from.b0) * amount,
+                 from.b1 + (to.b1 - from.b1) * amount,
+                 from.b2 + (to.b2 - from.b2) * amount,
+                 from.a1 + (to.a1 - from.a1) * amount,
+                 from.a2 + (to.a2 - from.a2) * amount };
+    }
+
     void updateFilters()
     {
         updateLow();
@@ -44,26 +122,81 @@ private:
         updateHigh();
     }
 
+    // The setters run on the message thread: they design into a local copy and
+    // hand it over in one piece, so the audio thread never sees a half update.
     void updateLow()
     {
-        *low.state = *juce::dsp::IIR::Coefficients<float>::makeHighPass(sampleRate, lowFrequency, lowQ);
+        designed[0] = makeHighPass(sampleRate, lowFrequency, lowQ);
+        handoff.push(designed);
     }
 
     void updateMid()
     {
-        *mid.state = *juce::dsp::IIR::Coefficients<float>::makePeakFilter(sampleRate, midFrequency, midQ, midGain);
+        designed[1] = makePeakFilter(sampleRate, midFrequency, midQ, midGain);
+        handoff.push(designed);
     }
 
     void updateHigh()
     {
-        *high.state = *juce::dsp::IIR::Coefficients<float>::makeHighShelf(sampleRate, highFrequency, highQ, highGain);
+        designed[2] = makeHighShelf(sampleRate, highFrequency, highQ, highGain);
+        handoff.push(designed);
+    }
+
+    // The juce::dsp::IIR::Coefficients designs, without the heap allocation
+    static Cascade::Section makeHighPass(double rate, float frequency, float q)
+    {
+        const float n = std::tan(juce::MathConstants<float>::pi * frequency / (float)rate);
+        const float nSquared = n * n;
+        const float invQ = 1.0f / q;
+        const float c1 = 1.0f / (1.0f + invQ * n + nSquared);
+        return normalise(c1, c1 * -2.0f, c1, 1.0f, c1 * 2.0f * (nSquared - 1.0f), c1 * (1.0f - invQ * n + nSquared));
+    }
+
+    static Cascade::Section makePeakFilter(double rate, float frequency, float q, float gainFactor)
+    {
+        const float A = juce::jmax(0.0f, std::sqrt(gainFactor));
+        const float omega = (2.0f * juce::MathConstants<float>::pi * juce::jmax(frequency, 2.0f)) / (float)rate;
+        const float alpha = std::sin(omega) / (q * 2.0f);
+        const float c2 = -2.0f * std::cos(omega);
+        const float alphaTimesA = alpha * A;
+        const float alphaOverA = alpha / A;
+        return normalise(1.0f + alphaTimesA, c2, 1.0f - alphaTimesA, 1.0f + alphaOverA, c2, 1.0f - alphaOverA);
+    }
+
+    static Cascade::Section makeHighShelf(double rate, float frequency, float q, float gainFactor)
+    {
+        const float A = juce::jmax(0.0f, std::sqrt(gainFactor));
+        const float aminus1 = A - 1.0f;
+        const float aplus1 = A + 1.0f;
+        const float omega = (2.0f * juce::MathConstants<float>::pi * juce::jmax(frequency, 2.0f)) / (float)rate;
+        const float coso = std::cos(omega);
+        const float beta = std::sin(omega) * std::sqrt(A) / q;
+        const float aminus1TimesCoso = aminus1 * coso;
+        return normalise(A * (aplus1 + aminus1TimesCoso + beta),
+                         A * -2.0f * (aminus1 + aplus1 * coso),
+                         A * (aplus1 + aminus1TimesCoso - beta),
+                         aplus1 - aminus1TimesCoso + beta,
+                         2.0f * (aminus1 - aplus1 * coso),
+                         aplus1 - aminus1TimesCoso - beta);
+    }
+
+    static Cascade::Section normalise(float b0, float b1, float b2, float a0, float a1, float a2)
+    {
+        const float a0Inv = a0 != 0.0f ? 1.0f / a0 : 0.0f;
+        return { b0 * a0Inv, b1 * a0Inv, b2 * a0Inv, a1 * a0Inv, a2 * a0Inv };
     }
 
     double sampleRate = 44100.0;
 
-    juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>> low;
-    juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>> mid;
-    juce::dsp::ProcessorDuplicator<juce::dsp::IIR::Filter<float>, juce::dsp::IIR::Coefficients<float>> high;
+    Cascade cascade;
+    Sections designed;
+    ParameterHandoff<Sections> handoff;
+
+    // Audio thread only
+    Sections applied, rampStart, rampTarget;
+    int rampLength = 1;
+    int rampRemaining = 0;
+    bool jumpToNextUpdate = true;
 
     // Filter parameter default values
     float lowFrequency = 15.0f;
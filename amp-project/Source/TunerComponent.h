@@ -1,11 +1,13 @@
 #pragma once
 #include <JuceHeader.h>
 #include <cmath>
+#include "PitchDetector.h"
 
 class TunerComponent : public juce::Component, private juce::Timer
 {
 public:
-    TunerComponent()
+    explicit TunerComponent(const PitchDetector& pitchSource)
+        : detector(pitchSource)
     {
         startTimerHz(30); // Redraw at 30 fps
     }
@@ -49,12 +51,14 @@ public:
     }
 
 private:
+    const PitchDetector& detector;
     float currentFrequency = 0.0f;
     float centsOffset = 0.0f;
     juce::String noteName = "-";
 
     void timerCallback() override
     {
+        setFrequency(detector.getFrequency());
         repaint();
     }
 
@@ -1,51 +1,163 @@
 #pragma once
 #include <JuceHeader.h>
-
-static float softClip(float sample) {
-    return sample / (std::abs(sample) + 1.0f);
-}
+#include "Waveshapes.h"
 
 class WaveshaperProcessor {
 public:
+    // Oversampling factors offered to the user; 1 runs the shapers at the device rate
+    static constexpr int maxOversamplingFactor = 8;
+
     WaveshaperProcessor() {
-        setPreEQFunction(softClip);
-        setPostEQFunction(softClip);
+        setPreEQFunction(Waveshapes::softClip);
+        setPostEQFunction(Waveshapes::softClip);
+
+        // One polyphase half-band cascade per factor and shaper, so switching never allocates
+        for (auto* shaper : { &preEQ, &postEQ }) {
+            for (int stage = 0; stage < numOversamplingStages; ++stage) {
+                shaper->oversamplers[stage] = std::make_unique<juce::dsp::Oversampling<float>>(
+                    1, (size_t)(stage + 1), juce::dsp::Oversampling<float>::filterHalfBandPolyphaseIIR, true, true);
+            }
+        }
     }
 
     void prepare(const juce::dsp::ProcessSpec& spec) {
-        waveShaperPreEQ.prepare(spec);
-        waveShaperPostEQ.prepare(spec);
+        for (auto* shaper : { &preEQ, &postEQ }) {
+            for (int stage = 0; stage < numOversamplingStages; ++stage)
+                shaper->oversamplers[stage]->initProcessing(spec.maximumBlockSize);
+            shaper->activeAntiderivatives = nullptr;
+            shaper->processingStage = -1;
+        }
     }
 
     void setPreEQFunction(float(*func)(float)) {
-        waveShaperPreEQ.functionToUse = func;
+        preEQ.function = func;
+        preEQ.antiderivatives = Waveshapes::findAntiderivatives(func);
     }
 
     void setPostEQFunction(float(*func)(float)) {
-        waveShaperPostEQ.functionToUse = func;
+        postEQ.function = func;
+        postEQ.antiderivatives = Waveshapes::findAntiderivatives(func);
+    }
+
+    // 1, 2, 4 or 8. Safe to call while audio is running.
+    void setOversamplingFactor(int factor) {
+        int stage = -1;
+        for (int f = juce::jlimit(1, maxOversamplingFactor, factor); f > 1; f >>= 1)
+            ++stage;
+        oversamplingStage = stage;
+    }
+
+    int getOversamplingFactor() const {
+        return 1 << (oversamplingStage.load() + 1);
+    }
+
+    // 0 shapes each sample directly, 1 and 2 use first or second order ADAA.
+    // Combines with oversampling. Safe to call while audio is running.
+    void setAntiderivativeOrder(int order) {
+        antiderivativeOrder = juce::jlimit(0, 2, order);
+    }
+
+    int getAntiderivativeOrder() const {
+        return antiderivativeOrder.load();
+    }
+
+    // Latency of both shapers together, at the device rate
+    int getLatencyInSamples() const {
+        const int stage = oversamplingStage.load();
+        double latency = 0.0;
+        if (stage >= 0)
+            latency += preEQ.oversamplers[stage]->getLatencyInSamples() + postEQ.oversamplers[stage]->getLatencyInSamples();
+
+        // Each ADAA shaper delays by half a sample per order, at the oversampled rate
+        latency += 2.0 * 0.5 * antiderivativeOrder.load() / getOversamplingFactor();
+        return juce::roundToInt(latency);
     }
 
     void processPreEQ(juce::dsp::AudioBlock<float>& block) {
-        auto* leftChannel = block.getChannelPointer(0);
-        auto* rightChannel = block.getChannelPointer(1);
-        for (int sample = 0; sample < block.getNumSamples(); ++sample) {
-            float processedSample = waveShaperPreEQ.processSample(leftChannel[sample]);
-            leftChannel[sample] = processedSample;
-            rightChannel[sample] = processedSample;
-        }
+        process(block, preEQ);
     }
 
     void processPostEQ(juce::dsp::AudioBlock<float>& block) {
+        process(block, postEQ);
+    }
+
+private:
+    static constexpr int numOversamplingStages = 3;
+
+    struct Shaper {
+        std::atomic<float(*)(float)> function{ Waveshapes::softClip };
+        std::unique_ptr<juce::dsp::Oversampling<float>> oversamplers[numOversamplingStages];
+        std::atomic<const Waveshapes::Antiderivatives*> antiderivatives{ nullptr };
+        const Waveshapes::Antiderivatives* activeAntiderivatives = nullptr;
+        Waveshapes::AntiderivativeState state;
+
+        // The settings this shaper is running with, taken at the start of each block
+        int processingStage = -1;
+        int processingOrder = 0;
+    };
+
+    // Each shaper picks up setting changes itself, since a signal graph can leave either one out
+    void latchSettings(Shaper& shaper) {
+        const int stage = oversamplingStage.load();
+        const int order = antiderivativeOrder.load();
+        if (stage != shaper.processingStage || order != shaper.processingOrder) {
+            // Don't let a cascade or ADAA history resume from the state it had when it was last used
+            if (stage >= 0)
+                shaper.oversamplers[stage]->reset();
+            shaper.activeAntiderivatives = nullptr;
+            shaper.processingStage = stage;
+            shaper.processingOrder = order;
+        }
+    }
+
+    // Shapes the left channel, optionally oversampled, and copies it to the right
+    // if there is one. SignalGraph keeps the shapers in front of the IR, where
+    // both channels carry the same signal.
+    void process(juce::dsp::AudioBlock<float>& block, Shaper& shaper) {
+        latchSettings(shaper);
         auto* leftChannel = block.getChannelPointer(0);
-        auto* rightChannel = block.getChannelPointer(1);
-        for (int sample = 0; sample < block.getNumSamples(); ++sample) {
-            float processedSample = waveShaperPostEQ.processSample(leftChannel[sample]);
-            leftChannel[sample] = processedSample;
-            rightChannel[sample] = processedSample;
+
+        if (shaper.processingStage >= 0) {
+            auto& oversampler = *shaper.oversamplers[shaper.processingStage];
+            auto leftBlock = block.getSingleChannelBlock(0);
+            auto oversampledBlock = oversampler.processSamplesUp(leftBlock);
+            shape(shaper, oversampledBlock.getChannelPointer(0), oversampledBlock.getNumSamples());
+            oversampler.processSamplesDown(leftBlock);
+        }
+        else {
+            shape(shaper, leftChannel, block.getNumSamples());
         }
+
+        if (block.getNumChannels() > 1)
+            juce::FloatVectorOperations::copy(block.getChannelPointer(1), leftChannel, (int)block.getNumSamples());
     }
 
-private:
-    juce::dsp::WaveShaper<float> waveShaperPreEQ;
-    juce::dsp::WaveShaper<float> waveShaperPostEQ;
-};
\ No newline at end of file
+    void shape(Shaper& shaper, float* data, size_t numSamples) {
+        const auto* antiderivatives = shaper.antiderivatives.load();
+
+        if (shaper.processingOrder > 0 && antiderivatives != nullptr) {
+            if (antiderivatives != shaper.activeAntiderivatives) {
+                shaper.state.reset(*antiderivatives);
+                shaper.activeAntiderivatives = antiderivatives;
+            }
+
+            if (shaper.processingOrder == 1) {
+                for (size_t sample = 0; sample < numSamples; ++sample)
+                    data[sample] = Waveshapes::processFirstOrder(*antiderivatives, shaper.state, data[sample]);
+            }
+            else {
+                for (size_t sample = 0; sample < numSamples; ++sample)
+                    data[sample] = Waveshapes::processSecondOrder(*antiderivatives, shaper.state, data[sample]);
+            }
+            return;
+        }
+
+        Waveshapes::processBlock(shaper.function.load(), data, numSamples);
+    }
+
+    Shaper preEQ;
+    Shaper postEQ;
+
+    std::atomic<int> oversamplingStage{ -1 };
+    std::atomic<int> antiderivativeOrder{ 0 };
+};
@@ -0,0 +1,427 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+#include "SIMDTarget.h"
+
+// The clipping curves the amp offers, plus the first and second antiderivatives
+// used for antiderivative anti-aliasing (ADAA). ADAA replaces f(x[n]) with the
+// divided difference of an antiderivative over the last samples, which acts as
+// a continuous-time lowpass on the shaper output and removes most of the
+// aliasing without oversampling. Antiderivatives are evaluated in double since
+// ADAA divides small differences of them.
+namespace Waveshapes
+{
+    // Block kernels for each curve, templated so the loop is inlined and
+    // vectorised with whichever of AVX, SSE2 or NEON the build targets. The
+    // scalar overload is the reference: it performs the same IEEE operations in
+    // the same order as the vector one, so block tails and builds without SIMD
+    // produce identical bits (as long as the compiler doesn't contract into FMA).
+    struct SoftClipKernel
+    {
+        static float process(float x)
+        {
+            const float denominator = std::abs(x) + 1.0f;
+            return x / denominator;
+        }
+
+       #if AMP_SIMD_AVX
+        static __m256 process(__m256 x)
+        {
+            const __m256 denominator = _mm256_add_ps(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), x), _mm256_set1_ps(1.0f));
+            return _mm256_div_ps(x, denominator);
+        }
+       #elif AMP_SIMD_SSE
+        static __m128 process(__m128 x)
+        {
+            const __m128 denominator = _mm_add_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), x), _mm_set1_ps(1.0f));
+            return _mm_div_ps(x, denominator);
+        }
+       #elif AMP_SIMD_NEON
+        static float32x4_t process(float32x4_t x)
+        {
+            return vdivq_f32(x, vaddq_f32(vabsq_f32(x), vdupq_n_f32(1.0f)));
+        }
+       #endif
+    };
+
+    // Clamps to +-limit. The vector max/min order matches the scalar branches for every non-NaN input, -0 included.
+    template <int limitTimesTwo>
+    struct ClampKernel
+    {
+        static constexpr float limit = 0.5f * (float)limitTimesTwo;
+
+        static float process(float x) { return x > limit ? limit : (x < -limit ? -limit : x); }
+
+       #if AMP_SIMD_AVX
+        static __m256 process(__m256 x) { return _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-limit)), _mm256_set1_ps(limit)); }
+       #elif AMP_SIMD_SSE
+        static __m128 process(__m128 x) { return _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-limit)), _mm_set1_ps(limit)); }
+       #elif AMP_SIMD_NEON
+        static float32x4_t process(float32x4_t x) { return vminq_f32(vmaxq_f32(x, vdupq_n_f32(-limit)), vdupq_n_f32(limit)); }
+       #endif
+    };
+
+    using HardClipKernel = ClampKernel<1>;
+
+    // 7th order Lambert continued fraction for tanh, within 1e-4 of std::tanh.
+    // Input is limited to +-5 where the fraction holds, output to +-1.
+    struct TanhClipKernel
+    {
+        static float process(float x)
+        {
+            x = ClampKernel<10>::process(x);
+            const float x2 = x * x;
+
+            float numerator = x2 + 378.0f;
+            numerator = numerator * x2;
+            numerator = numerator + 17325.0f;
+            numerator = numerator * x2;
+            numerator = numerator + 135135.0f;
+            numerator = numerator * x;
+
+            float denominator = x2 * 28.0f;
+            denominator = denominator + 3150.0f;
+            denominator = denominator * x2;
+            denominator = denominator + 62370.0f;
+            denominator = denominator * x2;
+            denominator = denominator + 135135.0f;
+
+            return ClampKernel<2>::process(numerator / denominator);
+        }
+
+       #if AMP_SIMD_AVX
+        static __m256 process(__m256 x)
+        {
+            x = ClampKernel<10>::process(x);
+            const __m256 x2 = _mm256_mul_ps(x, x);
+
+            __m256 numerator = _mm256_add_ps(x2, _mm256_set1_ps(378.0f));
+            numerator = _mm256_mul_ps(numerator, x2);
+            numerator = _mm256_add_ps(numerator, _mm256_set1_ps(17325.0f));
+            numerator = _mm256_mul_ps(numerator, x2);
+            numerator = _mm256_add_ps(numerator, _mm256_set1_ps(135135.0f));
+            numerator = _mm256_mul_ps(numerator, x);
+
+            __m256 denominator = _mm256_mul_ps(x2, _mm256_set1_ps(28.0f));
+            denominator = _mm256_add_ps(denominator, _mm256_set1_ps(3150.0f));
+            denominator = _mm256_mul_ps(denominator, x2);
+            denominator = _mm256_add_ps(denominator, _mm256_set1_ps(62370.0f));
+            denominator = _mm256_mul_ps(denominator, x2);
+            denominator = _mm256_add_ps(denominator, _mm256_set1_ps(135135.0f));
+
+            return ClampKernel<2>::process(_mm256_div_ps(numerator, denominator));
+        }
+       #elif AMP_SIMD_SSE
+        static __m128 process(__m128 x)
+        {
+            x = ClampKernel<10>::process(x);
+            const __m128 x2 = _mm_mul_ps(x, x);
+
+            __m128 numerator = _mm_add_ps(x2, _mm_set1_ps(378.0f));
+            numerator = _mm_mul_ps(numerator, x2);
+            numerator = _mm_add_ps(numerator, _mm_set1_ps(17325.0f));
+            numerator = _mm_mul_ps(numerator, x2);
+            numerator = _mm_add_ps(numerator, _mm_set1_ps(135135.0f));
+            numerator = _mm_mul_ps(numerator, x);
+
+            __m128 denominator = _mm_mul_ps(x2, _mm_set1_ps(28.0f));
+            denominator = _mm_add_ps(denominator, _mm_set1_ps(3150.0f));
+            denominator = _mm_mul_ps(denominator, x2);
+            denominator = _mm_add_ps(denominator, _mm_set1_ps(62370.0f));
+            denominator = _mm_mul_ps(denominator, x2);
+            denominator = _mm_add_ps(denominator, _mm_set1_ps(135135.0f));
+
+            return ClampKernel<2>::process(_mm_div_ps(numerator, denominator));
+        }
+       #elif AMP_SIMD_NEON
+        static float32x4_t process(float32x4_t x)
+        {
+            x = ClampKernel<10>::process(x);
+            const float32x4_t x2 = vmulq_f32(x, x);
+
+            float32x4_t numerator = vaddq_f32(x2, vdupq_n_f32(378.0f));
+            numerator = vmulq_f32(numerator, x2);
+            numerator = vaddq_f32(numerator, vdupq_n_f32(17325.0f));
+            numerator = vmulq_f32(numerator, x2);
+            numerator = vaddq_f32(numerator, vdupq_n_f32(135135.0f));
+            numerator = vmulq_f32(numerator, x);
+
+            float32x4_t denominator = vmulq_f32(x2, vdupq_n_f32(28.0f));
+            denominator = vaddq_f32(denominator, vdupq_n_f32(3150.0f));
+            denominator = vmulq_f32(denominator, x2);
+            denominator = vaddq_f32(denominator, vdupq_n_f32(62370.0f));
+            denominator = vmulq_f32(denominator, x2);
+            denominator = vaddq_f32(denominator, vdupq_n_f32(135135.0f));
+
+            return ClampKernel<2>::process(vdivq_f32(numerator, denominator));
+        }
+       #endif
+    };
+
+    template <typename Kernel>
+    inline void processBlock(float* data, size_t numSamples)
+    {
+        size_t i = 0;
+
+       #if AMP_SIMD_AVX
+        for (; i + 8 <= numSamples; i += 8)
+            _mm256_storeu_ps(data + i, Kernel::process(_mm256_loadu_ps(data + i)));
+       #elif AMP_SIMD_SSE
+        for (; i + 4 <= numSamples; i += 4)
+            _mm_storeu_ps(data + i, Kernel::process(_mm_loadu_ps(data + i)));
+       #elif AMP_SIMD_NEON
+        for (; i + 4 <= numSamples; i += 4)
+            vst1q_f32(data + i, Kernel::process(vld1q_f32(data + i)));
+       #endif
+
+        for (; i < numSamples; ++i)
+            data[i] = Kernel::process(data[i]);
+    }
+
+    inline float softClip(float sample) { return SoftClipKernel::process(sample); }
+    inline float hardClip(float sample) { return HardClipKernel::process(sample); }
+    inline float tanhClip(float sample) { return TanhClipKernel::process(sample); }
+
+    // Picks the kernel once per block; curves without one fall back to a call per sample
+    inline void processBlock(float (*func)(float), float* data, size_t numSamples)
+    {
+        if (func == softClip)
+            processBlock<SoftClipKernel>(data, numSamples);
+        else if (func == hardClip)
+            processBlock<HardClipKernel>(data, numSamples);
+        else if (func == tanhClip)
+            processBlock<TanhClipKernel>(data, numSamples);
+        else
+            for (size_t i = 0; i < numSamples; ++i)
+                data[i] = func(data[i]);
+    }
+
+    struct Antiderivatives
+    {
+        double (*shape)(double);
+        double (*first)(double);
+        double (*second)(double);
+    };
+
+    //==============================================================================
+    inline double softClipShape(double x) { return x / (std::abs(x) + 1.0); }
+
+    inline double softClipFirst(double x)
+    {
+        const double a = std::abs(x);
+        return a - std::log1p(a);
+    }
+
+    inline double softClipSecond(double x)
+    {
+        const double a = std::abs(x);
+        return std::copysign(0.5 * a * a - (1.0 + a) * std::log1p(a) + a, x);
+    }
+
+    //==============================================================================
+    inline double hardClipShape(double x) { return x > 0.5 ? 0.5 : (x < -0.5 ? -0.5 : x); }
+
+    inline double hardClipFirst(double x)
+    {
+        const double a = std::abs(x);
+        return a <= 0.5 ? 0.5 * a * a : 0.5 * a - 0.125;
+    }
+
+    inline double hardClipSecond(double x)
+    {
+        const double a = std::abs(x);
+        return std::copysign(a <= 0.5 ? a * a * a / 6.0 : 0.25 * a * a - 0.125 * a + 1.0 / 48.0, x);
+    }
+
+    //==============================================================================
+    inline double tanhClipShape(double x) { return std::tanh(x); }
+
+    // log(cosh(x)), written so it doesn't overflow for large |x|
+    inline double tanhClipFirst(double x)
+    {
+        const double a = std::abs(x);
+        return a + std::log1p(std::exp(-2.0 * a)) - 0.69314718055994531;
+    }
+
+    // Li2(-e^-2a)/2 + pi^2/24, the part of tanhClipSecond that needs a dilogarithm.
+    // The series goes through the Landen identity Li2(-z) = -Li2(z/(1+z)) - log(1+z)^2/2
+    // so its argument never exceeds 1/2. Too slow per sample; the table below is
+    // built from it.
+    inline double tanhClipDilogSeries(double a)
+    {
+        const double z = std::exp(-2.0 * a);
+        const double w = z / (1.0 + z);
+
+        double power = w;
+        double series = 0.0;
+        for (int k = 1; k < 60 && power > 1.0e-17; ++k)
+        {
+            series += power / (double)(k * k);
+            power *= w;
+        }
+
+        const double log1pZ = std::log1p(z);
+        return 0.5 * (-series - 0.5 * log1pZ * log1pZ) + 0.41123351671205660;
+    }
+
+    // tanhClipDilogSeries as quintic Hermite segments matching its value and first
+    // two derivatives at every node, within 1e-13 of it. The pieces join with
+    // continuous second derivatives, so second order ADAA, which divides
+    // differences of differences, doesn't see the joins.
+    class TanhClipDilogTable
+    {
+    public:
+        // Builds the table on first use; findAntiderivatives() calls it so that's not on the audio thread
+        static const TanhClipDilogTable& get()
+        {
+            static const TanhClipDilogTable table;
+            return table;
+        }
+
+        double operator()(double a) const
+        {
+            const double position = a * (double)segmentsPerUnit;
+            if (!(position < (double)numSegments))
+                return limit;
+
+            const int index = (int)position;
+            const double t = position - (double)index;
+            const auto& c = segments[(size_t)index];
+            return c[0] + t * (c[1] + t * (c[2] + t * (c[3] + t * (c[4] + t * c[5]))));
+        }
+
+    private:
+        static constexpr int segmentsPerUnit = 32;
+        static constexpr int numSegments = 18 * segmentsPerUnit;   // Past a = 18 it is within 2e-16 of its limit
+        static constexpr double limit = 0.41123351671205660;        // pi^2/24
+
+        TanhClipDilogTable()
+        {
+            // The derivatives in a are log(1 + e^-2a) and -2e^-2a / (1 + e^-2a)
+            const double h = 1.0 / segmentsPerUnit;
+            auto node = [h](double a, double& value, double& slope, double& curvature)
+            {
+                const double z = std::exp(-2.0 * a);
+                value = tanhClipDilogSeries(a);
+                slope = h * std::log1p(z);
+                curvature = h * h * -2.0 * z / (1.0 + z);
+            };
+
+            double g0, p0, q0;
+            node(0.0, g0, p0, q0);
+            for (int i = 0; i < numSegments; ++i)
+            {
+                double g1, p1, q1;
+                node((i + 1) * h, g1, p1, q1);
+
+                const double r0 = g1 - (g0 + p0 + 0.5 * q0);
+                const double r1 = p1 - (p0 + q0);
+                const double r2 = q1 - q0;
+                segments[(size_t)i] = { g0, p0, 0.5 * q0,
+                                        10.0 * r0 - 4.0 * r1 + 0.5 * r2,
+                                        -15.0 * r0 + 7.0 * r1 - r2,
+                                        6.0 * r0 - 3.0 * r1 + 0.5 * r2 };
+                g0 = g1;
+                p0 = p1;
+                q0 = q1;
+            }
+        }
+
+        std::array<std::array<double, 6>, (size_t)numSegments> segments;
+    };
+
+    // a^2/2 - a*log(2) + Li2(-e^-2a)/2 + pi^2/24, with the dilogarithm from the table
+    inline double tanhClipSecond(double x)
+    {
+        const double a = std::abs(x);
+        return std::copysign(0.5 * a * a - 0.69314718055994531 * a + TanhClipDilogTable::get()(a), x);
+    }
+
+    //==============================================================================
+    // Null for curves with no known antiderivatives, which then run without ADAA
+    inline const Antiderivatives* findAntiderivatives(float (*func)(float))
+    {
+        static const Antiderivatives softClipAD{ softClipShape, softClipFirst, softClipSecond };
+        static const Antiderivatives hardClipAD{ hardClipShape, hardClipFirst, hardClipSecond };
+        static const Antiderivatives tanhClipAD{ tanhClipShape, tanhClipFirst, tanhClipSecond };
+
+        if (func == softClip) return &softClipAD;
+        if (func == hardClip) return &hardClipAD;
+        if (func == tanhClip)
+        {
+            TanhClipDilogTable::get();
+            return &tanhClipAD;
+        }
+        return nullptr;
+    }
+
+    //==============================================================================
+    // Running state of one ADAA shaper. First order delays by half a sample,
+    // second order by one.
+    struct AntiderivativeState
+    {
+        double x1 = 0.0;
+        double x2 = 0.0;
+        double firstOfX1 = 0.0;
+        double secondOfX1 = 0.0;
+        double divided1 = 0.0;
+
+        void reset(const Antiderivatives& ad)
+        {
+            x1 = x2 = 0.0;
+            firstOfX1 = ad.first(0.0);
+            secondOfX1 = ad.second(0.0);
+            divided1 = ad.first(0.0);
+        }
+    };
+
+    constexpr double adaaTolerance = 1.0e-5;
+
+    inline float processFirstOrder(const Antiderivatives& ad, AntiderivativeState& state, float sample)
+    {
+        const double x0 = sample;
+        const double first0 = ad.first(x0);
+        const double diff = x0 - state.x1;
+
+        const double y = std::abs(diff) < adaaTolerance ? ad.shape(0.5 * (x0 + state.x1))
+                                                        : (first0 - state.firstOfX1) / diff;
+        state.x1 = x0;
+        state.firstOfX1 = first0;
+        return (float)y;
+    }
+
+    inline float processSecondOrder(const Antiderivatives& ad, AntiderivativeState& state, float sample)
+    {
+        const double x0 = sample;
+        const double second0 = ad.second(x0);
+        const double diff01 = x0 - state.x1;
+
+        // Divided difference of the second antiderivative between x0 and x1
+        const double divided0 = std::abs(diff01) < adaaTolerance ? ad.first(0.5 * (x0 + state.x1))
+                                                                 : (second0 - state.secondOfX1) / diff01;
+        const double diff02 = x0 - state.x2;
+        double y;
+
+        if (std::abs(diff02) >= adaaTolerance)
+        {
+            y = 2.0 * (divided0 - state.divided1) / diff02;
+        }
+        else
+        {
+            // x0 ~ x2: expand around their midpoint instead of dividing by ~0
+            const double xBar = 0.5 * (x0 + state.x2);
+            const double delta = xBar - state.x1;
+            y = std::abs(delta) < adaaTolerance
+                ? ad.shape(0.5 * (xBar + state.x1))
+                : (2.0 / delta) * (ad.first(xBar) + (state.secondOfX1 - ad.second(xBar)) / delta);
+        }
+
+        state.x2 = state.x1;
+        state.x1 = x0;
+        state.secondOfX1 = second0;
+        state.divided1 = divided0;
+        return (float)y;
+    }
+}